@@ -0,0 +1,127 @@
+/**
+ * @file bench_libconf.c
+ * @brief Micro benchmarks for the conf library.
+ *
+ * This file generates a configuration file with a large number of keys, loads
+ * it, and measures the latency of lookups of present and absent keys, as well
+ * as the false-positive rate of the Bloom filter used to reject absent keys.
+ *
+ */
+
+#include "conf_store.h"
+#include "libconf.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Configuration file path */
+#define BENCH_PATH "bench.conf"
+
+/* Benchmark settings */
+#define BENCH_KEYS	  100000
+#define BENCH_LOOKUPS 1000000
+
+/**
+ * @brief Returns a monotonic timestamp in nanoseconds.
+ */
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Writes a configuration file with the given number of keys.
+ */
+static int write_config(const char* path, int keys)
+{
+	FILE* fp = fopen(path, "w");
+	if (!fp) return -1;
+
+	for (int i = 0; i < keys; i++) {
+		if (i % 2) {
+			fprintf(fp, "service.key_%d=%d\n", i, i);
+		} else {
+			fprintf(fp, "service.key_%d=value_%d\n", i, i);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * @brief Measures the mean latency of conf_get_long() over a set of keys.
+ */
+static double bench_lookups(const conf_data* data, char (*keys)[32], int n)
+{
+	long   sum	 = 0;
+	double start = now_ns();
+	for (int i = 0; i < BENCH_LOOKUPS; i++) {
+		sum += conf_get_long(data, keys[i % n], 1);
+	}
+	double elapsed = now_ns() - start;
+
+	/* Keep the compiler from dropping the loop */
+	if (sum == 42) printf("\n");
+	return elapsed / BENCH_LOOKUPS;
+}
+
+int main(void)
+{
+	if (write_config(BENCH_PATH, BENCH_KEYS) != 0) {
+		fprintf(stderr, "Error: Could not write '%s'.\n", BENCH_PATH);
+		return -1;
+	}
+
+	double	   start = now_ns();
+	conf_data* data	 = conf_load(BENCH_PATH);
+	double	   load	 = now_ns() - start;
+	if (!data) {
+		fprintf(stderr, "Error: Could not load '%s'.\n", BENCH_PATH);
+		return -1;
+	}
+
+	char(*hits)[32]	  = malloc(BENCH_KEYS * sizeof(*hits));
+	char(*misses)[32] = malloc(BENCH_KEYS * sizeof(*misses));
+	if (!hits || !misses) {
+		fprintf(stderr, "Error: Could not allocate memory.\n");
+		return -1;
+	}
+	for (int i = 0; i < BENCH_KEYS; i++) {
+		snprintf(hits[i], sizeof(hits[i]), "service.key_%d", i);
+		snprintf(misses[i], sizeof(misses[i]), "service.opt_%d", i);
+	}
+
+	/* Count the absent keys that pass the Bloom filter */
+	int false_positives = 0;
+	for (int i = 0; i < BENCH_KEYS; i++) {
+		uint64_t hash	 = conf_hash(misses[i], NULL);
+		false_positives += conf_store_filter_test(data->store, hash);
+	}
+
+	double hit_ns  = bench_lookups(data, hits, BENCH_KEYS);
+	double miss_ns = bench_lookups(data, misses, BENCH_KEYS);
+
+	/* Measure misses again with the filter detached from the store */
+	uint64_t* filter	= data->store->filter;
+	data->store->filter = NULL;
+	double nofilter_ns	= bench_lookups(data, misses, BENCH_KEYS);
+	data->store->filter = filter;
+
+	printf("keys:                    %d\n", BENCH_KEYS);
+	printf("load:                    %.2f ms\n", load / 1e6);
+	printf("hit lookup:              %.1f ns\n", hit_ns);
+	printf("miss lookup:             %.1f ns\n", miss_ns);
+	printf("miss lookup (no filter): %.1f ns\n", nofilter_ns);
+	printf("filter false positives:  %.3f %%\n",
+		   100.0 * false_positives / BENCH_KEYS);
+
+	free(hits);
+	free(misses);
+	conf_free(data);
+	remove(BENCH_PATH);
+	return 0;
+}
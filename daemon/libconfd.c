@@ -0,0 +1,473 @@
+/**
+ * @file libconfd.c
+ * @brief Daemon that shares parsed configuration snapshots between processes.
+ *
+ * libconfd loads every configuration file its clients ask for into a handle,
+ * reloads the handles on SIGHUP and whenever inotify reports that the file or
+ * its journal was written or renamed into place, and keeps the latest snapshot
+ * of each file in a sealed memfd. The parent directory is watched rather than
+ * the file, so editors and tools that replace the file by renaming are seen.
+ * Clients connect to a Unix domain socket, name a file, and receive the
+ * descriptor of its snapshot with SCM_RIGHTS. All clients of a file share the
+ * same memfd, and every new snapshot is pushed to them as soon as it is
+ * published. A file is released once its last client disconnects. The daemon
+ * runs a single epoll loop.
+ *
+ * Only files below the configuration directory are served, after resolving
+ * symbolic links, and only to clients running as the user of the daemon or as
+ * root. The socket is created accessible to its owner only.
+ *
+ * Usage: libconfd <socket path> <configuration directory>
+ */
+
+#define _GNU_SOURCE
+
+#include "conf_proto.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Maximum number of events handled per wakeup */
+#define MAX_EVENTS 64
+
+/* Changes of a watched directory that reload the files in it */
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+/**
+ * @brief Configuration file served to clients.
+ */
+typedef struct {
+	char*		 filename;	 /**< Resolved name, NULL if the slot is free */
+	conf_handle* handle;	 /**< Handle reloaded on SIGHUP */
+	int			 notify_fd;	 /**< Readable once a snapshot is published */
+	int			 snapshot;	 /**< Sealed memfd of the latest snapshot */
+	int			 clients;	 /**< Number of clients served the file */
+	int			 wd;		 /**< inotify watch of the parent directory */
+} served_file;
+
+/**
+ * @brief Connected client.
+ */
+typedef struct {
+	int sock; /**< Connected socket, -1 if the slot is free */
+	int file; /**< Index of the file served to the client, -1 if none yet */
+} client;
+
+static served_file* files;
+static int			nfiles;
+static client*		clients;
+static int			nclients;
+static int			epoll_fd   = -1;
+static int			inotify_fd = -1;
+static char			root[PATH_MAX]; /* Resolved configuration directory */
+
+/* Tags of epoll events: the listening socket, a file, a client or inotify */
+#define TAG_LISTEN	0
+#define TAG_FILE	1
+#define TAG_CLIENT	2
+#define TAG_INOTIFY 3
+
+/**
+ * @brief Packs the tag and index of an epoll event.
+ */
+static uint64_t event_data(int tag, int index)
+{
+	return (uint64_t)tag << 32 | (uint32_t)index;
+}
+
+/**
+ * @brief Watches a descriptor for readability.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int watch(int fd, int tag, int index)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events	= EPOLLIN;
+	ev.data.u64 = event_data(tag, index);
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * @brief Watches the parent directory of a file for changes.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int watch_dir(served_file* file)
+{
+	/* Resolved names are absolute, so they contain a slash */
+	char		dir[PATH_MAX];
+	const char* slash = strrchr(file->filename, '/');
+	size_t		len	  = (size_t)(slash - file->filename);
+	if (len == 0) len = 1;
+	memcpy(dir, file->filename, len);
+	dir[len] = '\0';
+
+	file->wd = inotify_add_watch(inotify_fd, dir, WATCH_MASK);
+	return file->wd >= 0 ? 0 : -1;
+}
+
+/**
+ * @brief Removes the directory watch of a file unless another file shares it.
+ */
+static void unwatch_dir(int index)
+{
+	int wd = files[index].wd;
+	if (wd < 0) return;
+
+	files[index].wd = -1;
+	for (int i = 0; i < nfiles; i++) {
+		if (files[i].filename && files[i].wd == wd) return;
+	}
+	inotify_rm_watch(inotify_fd, wd);
+}
+
+/**
+ * @brief Releases a file no client is served anymore and frees its slot.
+ */
+static void release_file(int index)
+{
+	served_file* file = &files[index];
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, file->notify_fd, NULL);
+	unwatch_dir(index);
+	conf_handle_unwatch_sighup(file->handle);
+	conf_handle_free(file->handle);
+	if (file->snapshot >= 0) close(file->snapshot);
+	free(file->filename);
+	file->filename	= NULL;
+	file->handle	= NULL;
+	file->notify_fd = -1;
+	file->snapshot	= -1;
+}
+
+/**
+ * @brief Disconnects a client and frees its slot.
+ */
+static void drop_client(int index)
+{
+	int file = clients[index].file;
+	if (file >= 0 && --files[file].clients == 0) release_file(file);
+
+	close(clients[index].sock);
+	clients[index].sock = -1;
+	clients[index].file = -1;
+}
+
+/**
+ * @brief Replaces the memfd of a file by one of its current snapshot.
+ *
+ * @return 0 on success, -1 on failure, in which case the old memfd is kept.
+ */
+static int refresh_snapshot(served_file* file)
+{
+	conf_data* data = conf_handle_acquire(file->handle);
+	int		   fd	= conf_snapshot_fd(data);
+	conf_free(data);
+	if (fd < 0) return -1;
+
+	if (file->snapshot >= 0) close(file->snapshot);
+	file->snapshot = fd;
+	return 0;
+}
+
+/**
+ * @brief Resolves the name of a file and checks that it is below the root.
+ *
+ * @return 0 on success, -1 if the file does not exist or is outside the root.
+ */
+static int resolve(const char* filename, char* resolved)
+{
+	size_t len = strlen(root);
+	if (!realpath(filename, resolved)) return -1;
+
+	/* The root itself is a directory, so only names below it are served */
+	if (strncmp(resolved, root, len) != 0 ||
+		(resolved[len] != '/' && root[len - 1] != '/')) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Finds the file with the given name, loading it on first use.
+ *
+ * @return Index of the file, -1 on failure with @p status set.
+ */
+static int open_file(const char* filename, conf_error_code* status)
+{
+	char path[PATH_MAX];
+	*status = CONF_ERR_IO;
+	if (resolve(filename, path) != 0) return -1;
+
+	int index = nfiles;
+	for (int i = 0; i < nfiles; i++) {
+		if (!files[i].filename) {
+			index = i;
+		} else if (strcmp(files[i].filename, path) == 0) {
+			return i;
+		}
+	}
+
+	/* Reuse a free slot, so indices in epoll events stay valid */
+	*status = CONF_ERR_MEMORY;
+	if (index == nfiles) {
+		served_file* grown = (served_file*)realloc(
+			files, (nfiles + 1) * sizeof(served_file));
+		if (!grown) return -1;
+		files = grown;
+		memset(&files[nfiles], 0, sizeof(served_file));
+		files[nfiles].notify_fd = -1;
+		files[nfiles].snapshot	= -1;
+		files[nfiles].wd		= -1;
+		nfiles++;
+	}
+
+	conf_error	 err;
+	served_file* file = &files[index];
+	file->clients	  = 0;
+	file->handle	  = conf_handle_create(path, 0, &err);
+	if (!file->handle) {
+		*status = err.code;
+		return -1;
+	}
+	file->filename	= strdup(path);
+	file->notify_fd = conf_handle_notify_fd(file->handle);
+	if (!file->filename || file->notify_fd < 0 ||
+		refresh_snapshot(file) != 0 || watch_dir(file) != 0 ||
+		conf_handle_watch_sighup(file->handle) != 0) {
+		*status = CONF_ERR_IO;
+		goto fail;
+	}
+	if (watch(file->notify_fd, TAG_FILE, index) != 0) {
+		*status = CONF_ERR_IO;
+		conf_handle_unwatch_sighup(file->handle);
+		goto fail;
+	}
+	return index;
+
+fail:
+	if (file->snapshot >= 0) close(file->snapshot);
+	free(file->filename);
+	conf_handle_free(file->handle);
+	file->filename = NULL;
+	unwatch_dir(index);
+	file->handle   = NULL;
+	file->snapshot = -1;
+	return -1;
+}
+
+/**
+ * @brief Checks that the peer of a socket runs as the daemon user or as root.
+ *
+ * @return 0 if the peer is trusted, -1 otherwise.
+ */
+static int check_peer(int sock)
+{
+	struct ucred cred;
+	socklen_t	 len = sizeof(cred);
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+		len != sizeof(cred)) {
+		return -1;
+	}
+	return cred.uid == 0 || cred.uid == geteuid() ? 0 : -1;
+}
+
+/**
+ * @brief Accepts a pending connection.
+ */
+static void accept_client(int listen_fd)
+{
+	int sock = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (sock < 0) return;
+	if (check_peer(sock) != 0) {
+		close(sock);
+		return;
+	}
+
+	/* Reuse a free slot, so indices in epoll events stay valid */
+	int index = 0;
+	while (index < nclients && clients[index].sock >= 0) index++;
+	if (index == nclients) {
+		client* grown =
+			(client*)realloc(clients, (nclients + 1) * sizeof(client));
+		if (!grown) {
+			close(sock);
+			return;
+		}
+		clients = grown;
+		nclients++;
+	}
+	clients[index].sock = sock;
+	clients[index].file = -1;
+	if (watch(sock, TAG_CLIENT, index) != 0) drop_client(index);
+}
+
+/**
+ * @brief Answers the request of a client, or drops it once it disconnects.
+ */
+static void serve_client(int index)
+{
+	client* c = &clients[index];
+	char	filename[4096];
+	ssize_t len = recv(c->sock, filename, sizeof(filename), 0);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+	/* Clients send a single NUL-terminated request */
+	if (len <= 0 || c->file >= 0 || filename[len - 1] != '\0') {
+		drop_client(index);
+		return;
+	}
+
+	conf_error_code status = CONF_OK;
+	c->file				   = open_file(filename, &status);
+	if (c->file < 0) {
+		conf_proto_send(c->sock, status, -1);
+		drop_client(index);
+		return;
+	}
+	files[c->file].clients++;
+	if (conf_proto_send(c->sock, CONF_OK, files[c->file].snapshot) != 0) {
+		drop_client(index);
+	}
+}
+
+/**
+ * @brief Pushes the new snapshot of a file to all of its clients.
+ */
+static void push_snapshot(int index)
+{
+	served_file* file = &files[index];
+	uint64_t	 count;
+	if (read(file->notify_fd, &count, sizeof(count)) < 0) {
+		/* Drained already, nothing to do */
+	}
+	if (refresh_snapshot(file) != 0) return;
+
+	/* Clients that cannot take the snapshot right away are dropped */
+	for (int i = 0; i < nclients; i++) {
+		if (clients[i].sock < 0 || clients[i].file != index) continue;
+		if (conf_proto_send(clients[i].sock, CONF_OK, file->snapshot) != 0) {
+			drop_client(i);
+		}
+	}
+}
+
+/**
+ * @brief Reloads the files whose directory reported a change to them.
+ *
+ * A write to the journal of a file reloads the file as well. The reload
+ * publishes a new snapshot, which is pushed once the file becomes readable.
+ */
+static void reload_changed(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t len = read(inotify_fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR) continue;
+		if (len <= 0) return;
+
+		for (char* p = buf; p < buf + len;) {
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			p += sizeof(*ev) + ev->len;
+			if (!ev->len) continue;
+
+			for (int i = 0; i < nfiles; i++) {
+				if (!files[i].filename || files[i].wd != ev->wd) continue;
+				const char* name = strrchr(files[i].filename, '/') + 1;
+				size_t		n	 = strlen(name);
+				if (strncmp(ev->name, name, n) == 0 &&
+					(ev->name[n] == '\0' ||
+					 strcmp(ev->name + n, ".journal") == 0)) {
+					conf_handle_reload(files[i].handle, NULL);
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <socket path> <configuration directory>\n",
+				argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	struct stat st;
+	if (!realpath(argv[2], root) || stat(root, &st) != 0 ||
+		!S_ISDIR(st.st_mode)) {
+		fprintf(stderr, "Not a directory: %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, argv[1]);
+
+	/* Block SIGHUP before the library starts any thread */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	unlink(addr.sun_path);
+	epoll_fd   = epoll_create1(EPOLL_CLOEXEC);
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	/* Create the socket accessible to its owner only */
+	mode_t old_umask = umask(0177);
+	int	   bound	 = listen_fd >= 0 &&
+				 bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(old_umask);
+	if (listen_fd < 0 || epoll_fd < 0 || inotify_fd < 0 || !bound ||
+		listen(listen_fd, SOMAXCONN) != 0 ||
+		watch(listen_fd, TAG_LISTEN, 0) != 0 ||
+		watch(inotify_fd, TAG_INOTIFY, 0) != 0) {
+		perror("libconfd");
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		struct epoll_event events[MAX_EVENTS];
+		int				   n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			perror("libconfd");
+			return EXIT_FAILURE;
+		}
+
+		for (int i = 0; i < n; i++) {
+			int tag	  = (int)(events[i].data.u64 >> 32);
+			int index = (int)(uint32_t)events[i].data.u64;
+			if (tag == TAG_LISTEN) {
+				accept_client(listen_fd);
+			} else if (tag == TAG_INOTIFY) {
+				reload_changed();
+			} else if (tag == TAG_FILE && files[index].filename) {
+				push_snapshot(index);
+			} else if (clients[index].sock >= 0) {
+				serve_client(index);
+			}
+		}
+	}
+}
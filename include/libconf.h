@@ -50,14 +50,111 @@ typedef struct {
 	conf_value value;			 /**< Value */
 } conf_pair;
 
+/**
+ * @brief Opaque structure-of-arrays storage of the key-value pairs.
+ */
+typedef struct conf_store conf_store;
+
+/**
+ * @brief Opaque runtime overrides of loaded configuration data.
+ */
+typedef struct conf_overrides conf_overrides;
+
 /**
  * @brief Struct for storing configuration data.
+ *
+ * The pairs are stored internally in a structure-of-arrays layout. The @p pairs
+ * array is a view of that storage which is materialized on the first call to
+ * conf_get_pair(), and is NULL until then. Versions created by conf_set() and
+ * conf_remove() share the storage of the loaded data and keep their changes
+ * in @p overrides; their @p pairs array is always NULL.
  */
 typedef struct {
-	conf_pair* pairs; /**< Array of key-value pairs */
-	int		   count; /**< Number of key-value pairs */
+	conf_pair*		pairs;	   /**< Materialized array of key-value pairs */
+	int				count;	   /**< Number of key-value pairs */
+	conf_store*		store;	   /**< Internal pair storage */
+	conf_overrides* overrides; /**< Runtime overrides, NULL if none */
 } conf_data;
 
+/**
+ * @brief Struct for storing memory statistics of configuration data.
+ */
+typedef struct {
+	size_t pairs;		   /**< Number of key-value pairs */
+	size_t strings;		   /**< Number of string values */
+	size_t inline_strings; /**< Number of strings stored in their value slot */
+	size_t shared_strings; /**< Number of strings sharing a stored copy */
+	size_t pool_bytes;	   /**< Bytes used by stored string copies */
+	size_t saved_bytes;	   /**< Bytes saved by sharing string copies */
+	size_t total_bytes;	   /**< Total bytes allocated for the data */
+} conf_stats;
+
+/**
+ * @brief Enumeration of errors reported while loading configuration files.
+ */
+typedef enum {
+	CONF_OK,		  /**< No error */
+	CONF_ERR_IO,	  /**< The file could not be opened or read */
+	CONF_ERR_MEMORY,  /**< Memory could not be allocated */
+	CONF_ERR_SYNTAX,  /**< A line is not a key-value pair */
+	CONF_ERR_KEY,	  /**< A key is empty or too long */
+	CONF_ERR_QUOTE,	  /**< A quoted value is unterminated or malformed */
+	CONF_ERR_HEREDOC, /**< A heredoc has no terminator */
+	CONF_ERR_SCHEMA,  /**< A schema rule is malformed */
+	CONF_ERR_MISSING, /**< A required key is missing */
+	CONF_ERR_TYPE,	  /**< A value has the wrong type */
+	CONF_ERR_RANGE,	  /**< A value is out of range */
+	CONF_ERR_ENUM,	  /**< A value is not one of the allowed values */
+} conf_error_code;
+
+/**
+ * @brief Struct for storing diagnostics of loading or validating
+ * configuration data.
+ */
+typedef struct {
+	conf_error_code code;	  /**< Error code of the first problem */
+	int				line;	  /**< Line of the first problem, starting at 1 */
+	int				column;	  /**< Column of the first problem, from 1 */
+	const char*		reason;	  /**< Description of the first problem */
+	const char*		key;	  /**< Key of the first problem, if known */
+	int				problems; /**< Number of problems found */
+} conf_error;
+
+/**
+ * @brief Flags for loading configuration files.
+ */
+typedef enum {
+	CONF_STRICT = 1 << 0, /**< Fail on the first malformed line */
+	CONF_JSON	= 1 << 1, /**< Parse the file as JSON with flattened keys */
+	CONF_INI	= 1 << 2, /**< Parse INI sections, ';' comments, folded keys */
+	CONF_ENV	= 1 << 3, /**< Parse dotenv and EnvironmentFile quoting */
+} conf_load_flags;
+
+/**
+ * @brief Opaque compiled schema for validating configuration data.
+ */
+typedef struct conf_schema conf_schema;
+
+/**
+ * @brief Opaque handle that publishes snapshots of a configuration file.
+ */
+typedef struct conf_handle conf_handle;
+
+/**
+ * @brief Opaque transaction that stages changes to a handle.
+ */
+typedef struct conf_txn conf_txn;
+
+/**
+ * @brief Opaque connection to libconfd that receives snapshots.
+ */
+typedef struct conf_client conf_client;
+
+/**
+ * @brief Opaque append-only journal of durable overrides of a file.
+ */
+typedef struct conf_journal conf_journal;
+
 /**
  * @brief Reads a configuration file and returns a pointer to the conf_data
  * struct.
@@ -66,21 +163,193 @@ typedef struct {
  *
  * @return Pointer to the conf_data struct on success, NULL on failure.
  *
- * The conf_data struct should be freed using the conf_free() function when it
- * is no longer needed.
+ * Malformed lines are skipped. Errors are printed to stderr. The conf_data
+ * struct should be freed using the conf_free() function when it is no longer
+ * needed.
  */
 conf_data* conf_load(const char* filename);
 
+/**
+ * @brief Reads a configuration file with the given flags and reports
+ * diagnostics.
+ *
+ * @param[in]  filename Name of the configuration file.
+ * @param[in]  flags    Bitwise OR of conf_load_flags.
+ * @param[out] err      Pointer to the conf_error struct to fill in, may be
+ * NULL.
+ *
+ * @return Pointer to the conf_data struct on success, NULL on failure.
+ *
+ * Malformed lines are skipped unless CONF_STRICT is given, in which case the
+ * first malformed line fails the load. In both cases @p err describes the first
+ * malformed line, with line and column numbers counting from 1, and counts the
+ * malformed lines in its @p problems member. Columns refer to the line after
+ * comments are removed and continuation lines are joined. If the file cannot
+ * be read or memory cannot be allocated, the error code is CONF_ERR_IO or
+ * CONF_ERR_MEMORY and errno describes the cause. Nothing is printed.
+ *
+ * With CONF_JSON, the file is parsed as a JSON object or array instead. Its
+ * scalars are stored under keys joining the member names with '.' and the
+ * array indices in brackets, such as "servers[0].port"; null values are
+ * skipped. Syntax errors always fail the load, while values under empty or
+ * too long keys are skipped unless CONF_STRICT is given.
+ *
+ * With CONF_INI, lines of the form '[section]' prefix the keys of the
+ * following lines with the section name and a '.', comments may also start
+ * with ';', and keys and section names are folded to lower case when they are
+ * loaded. Look up such keys in lower case, such as "server.port".
+ *
+ * With CONF_ENV, lines may start with 'export', values may be single-quoted
+ * without escape sequences, quoted values may span several lines, lines
+ * starting with ';' are comments as in systemd EnvironmentFiles, and empty
+ * values are empty strings.
+ */
+conf_data* conf_load_ex(const char* filename, int flags, conf_error* err);
+
+/**
+ * @brief Sets the directory of the parse cache.
+ *
+ * @param[in] dir Existing directory to keep cache files in, NULL to disable
+ * the cache.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ *
+ * With a cache directory set, loading a file that parsed without malformed
+ * lines saves its parsed data to a cache file named after its path. Later
+ * loads of the unchanged file, also by other processes, map the cache file
+ * instead of parsing the file. A file counts as unchanged if its device,
+ * inode, size and modification time match; if it was modified no earlier than
+ * the cache file was written, its contents must match as well. The cache is
+ * disabled by default.
+ */
+int conf_set_cache_dir(const char* dir);
+
 /**
  * @brief Frees the memory allocated by a conf_data struct.
  *
  * @param[in] data Pointer to the conf_data struct to free.
  *
  * This function should be called when the conf_data struct is no longer needed
- * to free the memory allocated by the struct and its members.
+ * to free the memory allocated by the struct and its members. If references
+ * were taken with conf_retain(), the memory is freed once the last reference
+ * is dropped.
  */
 void conf_free(conf_data* data);
 
+/**
+ * @brief Takes another reference to a conf_data struct.
+ *
+ * @param[in] data Pointer to the conf_data struct, may be NULL.
+ *
+ * @return @p data. Every reference must be dropped with conf_free().
+ *
+ * References may be taken and dropped from any thread.
+ */
+conf_data* conf_retain(conf_data* data);
+
+/**
+ * @brief Creates a version of configuration data with a value set.
+ *
+ * @param[in] data  Pointer to the conf_data struct, which is not modified.
+ * @param[in] key   Key string, shorter than MAX_KEY_LEN.
+ * @param[in] type  Type of the value.
+ * @param[in] value Value; string values are copied.
+ *
+ * @return Pointer to the new version on success, NULL on failure with errno
+ * set.
+ *
+ * The new version shares all unchanged data with @p data, so an update costs
+ * O(log n) memory, and both stay valid and unchanged until they are freed using
+ * the conf_free() function. Readers of a version need no locks. Integers are
+ * stored as CONF_LONG and floats as CONF_DOUBLE, as the loader does.
+ */
+conf_data* conf_set(conf_data* data, const char* key, conf_type type,
+					conf_value value);
+
+/**
+ * @brief Creates a version of configuration data with a key removed.
+ *
+ * @param[in] data Pointer to the conf_data struct, which is not modified.
+ * @param[in] key  Key string.
+ *
+ * @return Pointer to the new version on success, NULL on failure with errno
+ * set. If @p key is not present, @p data is returned with another reference.
+ *
+ * Like conf_set(), the new version shares all unchanged data with @p data and
+ * should be freed using the conf_free() function.
+ */
+conf_data* conf_remove(conf_data* data, const char* key);
+
+/**
+ * @brief Opens the override journal of a configuration file for appending.
+ *
+ * @param[in] filename     Name of the configuration file; the journal is the
+ *                         file of the same name with the suffix ".journal".
+ * @param[in] flags        conf_load_flags the file is loaded with; they decide
+ *                         which keys the journal accepts.
+ * @param[in] compact_size Size of the journal in bytes beyond which it is
+ *                         compacted, 0 for never.
+ *
+ * @return Pointer to the journal on success, NULL on failure with errno set.
+ *
+ * conf_load_ex() and all loaders built on it replay the journal on top of the
+ * file. A partial record left by a crash is cut off when the journal is opened.
+ * Only one process should append to a journal at a time. The journal should be
+ * closed using the conf_journal_close() function.
+ */
+conf_journal* conf_journal_open(const char* filename, int flags,
+								size_t compact_size);
+
+/**
+ * @brief Durably records a value to set on top of a configuration file.
+ *
+ * @param[in] journal Pointer to the journal.
+ * @param[in] key     Key string, shorter than MAX_KEY_LEN. Unless the journal
+ *                    was opened with CONF_JSON, it must not hold '=', '#' or
+ *                    line breaks or have surrounding spaces.
+ * @param[in] type    Type of the value.
+ * @param[in] value   Value to record.
+ *
+ * @return 0 once the record is on disk, -1 on failure with errno set.
+ *
+ * The record is appended with a single write and synced with fdatasync(). It
+ * does not change data that is already loaded; apply it with conf_set() as well
+ * to publish it without a reload.
+ */
+int conf_journal_set(conf_journal* journal, const char* key, conf_type type,
+					 conf_value value);
+
+/**
+ * @brief Durably records the removal of a key from a configuration file.
+ *
+ * @param[in] journal Pointer to the journal.
+ * @param[in] key     Key string, as for conf_journal_set().
+ *
+ * @return 0 once the record is on disk, -1 on failure with errno set.
+ */
+int conf_journal_remove(conf_journal* journal, const char* key);
+
+/**
+ * @brief Compacts a journal by dropping all but the last change of each key.
+ *
+ * @param[in] journal Pointer to the journal.
+ *
+ * @return 0 on success, -1 on failure with errno set, in which case the old
+ * journal is kept.
+ *
+ * Writes the remaining changes to a temporary journal and renames it over the
+ * old one. The configuration file is never modified, and values keep the types
+ * they were journaled with.
+ */
+int conf_journal_compact(conf_journal* journal);
+
+/**
+ * @brief Closes a journal.
+ *
+ * @param[in] journal Pointer to the journal, may be NULL.
+ */
+void conf_journal_close(conf_journal* journal);
+
 /**
  * @brief Gets a pointer to a conf_pair struct for a given key.
  *
@@ -178,4 +447,465 @@ const char* conf_get_string(const conf_data* data, const char* key,
  */
 char conf_get_char(const conf_data* data, const char* key, char default_value);
 
+/**
+ * @brief Gets memory statistics of a conf_data struct.
+ *
+ * @param[in]  data  Pointer to the conf_data struct.
+ * @param[out] stats Pointer to the conf_stats struct to fill in.
+ *
+ * String values that are repeated in the configuration file share a single
+ * stored copy; the number of such values and the bytes saved by sharing are
+ * reported in @p stats.
+ */
+void conf_get_stats(const conf_data* data, conf_stats* stats);
+
+/**
+ * @brief Callback receiving the output of conf_write_json().
+ *
+ * @param[in] chunk Bytes of output, valid only during the callback.
+ * @param[in] len   Number of bytes in @p chunk.
+ * @param[in] ctx   Context given to conf_write_json().
+ *
+ * @return 0 to continue, nonzero to stop writing.
+ */
+typedef int (*conf_write_cb)(const char* chunk, size_t len, void* ctx);
+
+/**
+ * @brief Writes configuration data as a JSON object.
+ *
+ * @param[in] data  Pointer to the conf_data struct.
+ * @param[in] write Function to call with each chunk of output.
+ * @param[in] ctx   Context to pass to @p write.
+ *
+ * @return 0 on success, -1 if @p write stopped writing or an argument is
+ * NULL.
+ *
+ * Each pair becomes a member named after its key, including runtime
+ * overrides. Strings are escaped, numbers are written unquoted, and doubles
+ * that are not finite are written as null. The output is passed to @p write in
+ * chunks of a fixed-size buffer on the stack, so nothing is allocated however
+ * many pairs there are.
+ */
+int conf_write_json(const conf_data* data, conf_write_cb write, void* ctx);
+
+/**
+ * @brief Loads many configuration files at once.
+ *
+ * @param[in]  filenames Names of the configuration files.
+ * @param[in]  count     Number of files.
+ * @param[in]  flags     Bitwise OR of conf_load_flags values.
+ * @param[out] results   Array of @p count pointers, receives the conf_data
+ * struct of each file, or NULL if the file failed to load.
+ * @param[out] errors    Array of @p count conf_error structs to fill in, may be
+ * NULL.
+ *
+ * @return Number of files loaded, -1 if an argument is invalid.
+ *
+ * On Linux, the opens and reads of all files are submitted through io_uring,
+ * and each file is parsed as soon as it is read. Elsewhere, or if io_uring is
+ * not available, the files are loaded by a pool of threads. Each loaded
+ * conf_data struct should be freed using the conf_free() function.
+ */
+int conf_load_batch(const char* const* filenames, int count, int flags,
+					conf_data** results, conf_error* errors);
+
+/**
+ * @brief Callback of a non-blocking load.
+ *
+ * @param[in] data Pointer to the loaded conf_data struct, NULL on failure. The
+ * callback owns it and should free it using the conf_free() function.
+ * @param[in] err  Error info of the load, valid during the callback.
+ * @param[in] ctx  Context given to conf_load_async().
+ */
+typedef void (*conf_load_cb)(conf_data* data, const conf_error* err,
+							 void* ctx);
+
+/**
+ * @brief Loads a configuration file without blocking the calling thread.
+ *
+ * @param[in] filename Name of the configuration file.
+ * @param[in] flags    Bitwise OR of conf_load_flags values.
+ * @param[in] callback Function to call once the file is loaded.
+ * @param[in] ctx      Context to pass to the callback.
+ *
+ * @return 0 if the load is queued, -1 on failure.
+ *
+ * The file is read and parsed by a worker thread owned by the library. Once
+ * it is done, the descriptor returned by conf_async_fd() becomes readable, and
+ * conf_async_dispatch() calls the callback on the calling thread.
+ */
+int conf_load_async(const char* filename, int flags, conf_load_cb callback,
+					void* ctx);
+
+/**
+ * @brief Returns the descriptor that signals finished non-blocking loads.
+ *
+ * @return File descriptor to wait on for readability, -1 on failure.
+ *
+ * The descriptor stays readable until conf_async_dispatch() is called. It is
+ * owned by the library and must not be closed. On Linux it is an eventfd.
+ */
+int conf_async_fd(void);
+
+/**
+ * @brief Calls the callbacks of all finished non-blocking loads.
+ *
+ * @return Number of callbacks called.
+ *
+ * Callbacks are called in the order the loads finished, on the calling
+ * thread, and may queue new loads.
+ */
+int conf_async_dispatch(void);
+
+/**
+ * @brief Loads a configuration file into a handle that can reload it.
+ *
+ * @param[in]  filename Name of the configuration file.
+ * @param[in]  flags    Bitwise OR of conf_load_flags values.
+ * @param[out] err      Pointer to the conf_error struct to fill in, may be
+ * NULL.
+ *
+ * @return Pointer to the handle on success, NULL on failure.
+ *
+ * The loaded data is published as the first snapshot, with generation 1. The
+ * handle should be freed using the conf_handle_free() function.
+ */
+conf_handle* conf_handle_create(const char* filename, int flags,
+								conf_error* err);
+
+/**
+ * @brief Frees a handle.
+ *
+ * @param[in] handle Pointer to the handle to free.
+ *
+ * Snapshots acquired from the handle stay valid until they are freed.
+ */
+void conf_handle_free(conf_handle* handle);
+
+/**
+ * @brief Reloads the configuration file of a handle and publishes the result.
+ *
+ * @param[in]  handle Pointer to the handle.
+ * @param[out] err    Pointer to the conf_error struct to fill in, may be NULL.
+ *
+ * @return 0 on success, -1 on failure, in which case the current snapshot is
+ * kept.
+ */
+int conf_handle_reload(conf_handle* handle, conf_error* err);
+
+/**
+ * @brief Publishes new data as the current snapshot of a handle.
+ *
+ * @param[in] handle Pointer to the handle.
+ * @param[in] data   Pointer to the conf_data struct, the handle takes over the
+ * reference.
+ *
+ * @return Generation of the published snapshot.
+ */
+unsigned long conf_handle_publish(conf_handle* handle, conf_data* data);
+
+/**
+ * @brief Acquires the current snapshot of a handle.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * @return Pointer to the conf_data struct, which stays valid and unchanged
+ * until it is freed using the conf_free() function.
+ */
+conf_data* conf_handle_acquire(conf_handle* handle);
+
+/**
+ * @brief Returns the generation of the current snapshot of a handle.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * @return Generation, incremented by every published snapshot.
+ */
+unsigned long conf_handle_generation(const conf_handle* handle);
+
+/**
+ * @brief Sets the number of replaced snapshots a handle retains for rollback.
+ *
+ * @param[in] handle Pointer to the handle.
+ * @param[in] depth  Number of snapshots to retain, 0 to retain none.
+ *
+ * @return 0 on success, -1 on failure.
+ *
+ * The newest retained snapshots are kept if the depth shrinks. Snapshots
+ * created with conf_set() share most of their memory with their predecessor,
+ * so retaining them costs little. No snapshots are retained by default.
+ */
+int conf_handle_set_history(conf_handle* handle, int depth);
+
+/**
+ * @brief Republishes a snapshot the handle replaced before.
+ *
+ * @param[in] handle      Pointer to the handle.
+ * @param[in] generations Number of publishes to go back, 1 for the snapshot
+ * replaced last.
+ *
+ * @return Generation of the republished snapshot, 0 with errno set to EINVAL
+ * if no such snapshot is retained.
+ *
+ * The rollback takes constant time and publishes the retained snapshot like
+ * any other, with a new generation; the snapshot it replaces is retained in
+ * turn, so rolling back by 1 again undoes the rollback.
+ */
+unsigned long conf_rollback(conf_handle* handle, int generations);
+
+/**
+ * @brief Waits until a handle publishes a snapshot after a known generation.
+ *
+ * @param[in] handle          Pointer to the handle.
+ * @param[in] last_generation Generation the caller has seen last.
+ * @param[in] timeout_ms      Maximum time to wait in milliseconds, negative to
+ * wait forever.
+ *
+ * @return 1 if the generation differs from @p last_generation, 0 on timeout.
+ *
+ * Waiting threads block in the kernel, on Linux on a futex, and wake as soon
+ * as a snapshot is published.
+ */
+int conf_wait_for_change(conf_handle* handle, unsigned long last_generation,
+						 int timeout_ms);
+
+/**
+ * @brief Reloads a handle whenever the process receives SIGHUP.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * @return 0 on success, -1 on failure.
+ *
+ * A driver thread owned by the library reloads all watched handles, so no
+ * parsing happens in signal context, and signals that arrive during a reload
+ * cause a single further reload. On Linux, SIGHUP is blocked in the calling
+ * thread and read from a signalfd; call this function before other threads
+ * are started, or block SIGHUP in them, so the signal is not delivered to a
+ * thread that does not block it. Elsewhere, a SIGHUP handler is installed that
+ * wakes the driver through a self-pipe.
+ */
+int conf_handle_watch_sighup(conf_handle* handle);
+
+/**
+ * @brief Stops reloading a handle on SIGHUP.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * No reload of the handle is running once this function returns, so the
+ * handle may be freed afterwards.
+ */
+void conf_handle_unwatch_sighup(conf_handle* handle);
+
+/**
+ * @brief Returns a descriptor that signals published snapshots.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * @return File descriptor to wait on for readability, -1 on failure.
+ *
+ * The descriptor becomes readable whenever a snapshot is published and stays
+ * readable until it is read from. On Linux it is an eventfd, and reading its
+ * 8-byte counter returns the number of snapshots published since the last
+ * read. It is owned by the handle and must not be closed.
+ */
+int conf_handle_notify_fd(conf_handle* handle);
+
+/**
+ * @brief Begins a transaction on a handle.
+ *
+ * @param[in] handle Pointer to the handle.
+ *
+ * @return Pointer to the transaction on success, NULL on failure.
+ *
+ * Changes staged in the transaction are not visible until it is committed
+ * with conf_txn_commit(), or discarded with conf_txn_abort(). A transaction
+ * must be used by one thread at a time.
+ */
+conf_txn* conf_txn_begin(conf_handle* handle);
+
+/**
+ * @brief Stages setting a value in a transaction.
+ *
+ * @param[in] txn   Pointer to the transaction.
+ * @param[in] key   Key string, shorter than MAX_KEY_LEN.
+ * @param[in] type  Type of the value.
+ * @param[in] value Value; string values are copied.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int conf_txn_set(conf_txn* txn, const char* key, conf_type type,
+				 conf_value value);
+
+/**
+ * @brief Stages removing a key in a transaction.
+ *
+ * @param[in] txn Pointer to the transaction.
+ * @param[in] key Key string, shorter than MAX_KEY_LEN.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int conf_txn_remove(conf_txn* txn, const char* key);
+
+/**
+ * @brief Publishes all changes of a transaction as a single snapshot.
+ *
+ * @param[in] txn Pointer to the transaction, freed by this function.
+ *
+ * @return Generation of the published snapshot, or the current generation if
+ * nothing was staged; 0 on failure, in which case nothing is published.
+ *
+ * The changes are applied in the order they were staged, like conf_set() and
+ * conf_remove() would, on top of the snapshot that is current at the time of
+ * the commit. Readers see either none or all of them, and the generation is
+ * bumped and the notification descriptor signalled once.
+ */
+unsigned long conf_txn_commit(conf_txn* txn);
+
+/**
+ * @brief Discards a transaction.
+ *
+ * @param[in] txn Pointer to the transaction, freed by this function.
+ */
+void conf_txn_abort(conf_txn* txn);
+
+/**
+ * @brief Saves configuration data as a snapshot in a sealed memfd.
+ *
+ * @param[in] data Pointer to the conf_data struct.
+ *
+ * @return File descriptor of the snapshot, -1 on failure.
+ *
+ * The snapshot holds the parsed pairs in a relocatable layout and is sealed
+ * against writing, growing and shrinking, so it can be passed to other
+ * processes and mapped with conf_snapshot_map() without parsing or copying.
+ * Runtime overrides are copied into the snapshot, which maps as loaded data
+ * without overrides. The caller owns the descriptor. Snapshots need Linux;
+ * elsewhere this function fails with errno set to ENOSYS.
+ */
+int conf_snapshot_fd(const conf_data* data);
+
+/**
+ * @brief Maps a snapshot created by conf_snapshot_fd().
+ *
+ * @param[in] fd File descriptor of the snapshot.
+ *
+ * @return Pointer to the conf_data struct on success, NULL if the descriptor
+ * is not a sealed snapshot or on failure.
+ *
+ * The snapshot is mapped privately, and only pages holding string values are
+ * copied. The descriptor may be closed afterwards. The conf_data struct should
+ * be freed using the conf_free() function.
+ */
+conf_data* conf_snapshot_map(int fd);
+
+/**
+ * @brief Connects to libconfd and attaches to the snapshot of a file.
+ *
+ * @param[in]  socket_path Path of the Unix domain socket of the daemon.
+ * @param[in]  filename    Name of the configuration file, as seen by the
+ * daemon.
+ * @param[out] err         Pointer to the conf_error struct to fill in, may be
+ * NULL.
+ *
+ * @return Pointer to the client on success, NULL on failure.
+ *
+ * The daemon loads and watches the file and sends its current snapshot, which
+ * the client maps before returning. If the daemon fails to load the file, the
+ * error code is the one of the load. The client should be freed using the
+ * conf_client_close() function.
+ */
+conf_client* conf_client_connect(const char* socket_path, const char* filename,
+								 conf_error* err);
+
+/**
+ * @brief Closes a connection to libconfd.
+ *
+ * @param[in] client Pointer to the client.
+ *
+ * Snapshots acquired from the client stay valid until they are freed.
+ */
+void conf_client_close(conf_client* client);
+
+/**
+ * @brief Returns the descriptor that signals snapshots pushed by libconfd.
+ *
+ * @param[in] client Pointer to the client.
+ *
+ * @return File descriptor to wait on for readability.
+ *
+ * The descriptor becomes readable whenever the daemon pushes a new snapshot,
+ * and stays readable until conf_client_update() is called. It is owned by the
+ * client and must not be closed.
+ */
+int conf_client_fd(const conf_client* client);
+
+/**
+ * @brief Maps all snapshots pushed by libconfd and makes the last one current.
+ *
+ * @param[in] client Pointer to the client.
+ *
+ * @return 1 if the current snapshot changed, 0 if none was pending, -1 if the
+ * connection failed, in which case the current snapshot is kept.
+ */
+int conf_client_update(conf_client* client);
+
+/**
+ * @brief Acquires the current snapshot of a client.
+ *
+ * @param[in] client Pointer to the client.
+ *
+ * @return Pointer to the conf_data struct, which stays valid and unchanged
+ * until it is freed using the conf_free() function.
+ */
+conf_data* conf_client_acquire(conf_client* client);
+
+/**
+ * @brief Reads a schema file and compiles it for validating configuration
+ * data.
+ *
+ * @param[in]  filename Name of the schema file.
+ * @param[out] err      Pointer to the conf_error struct to fill in, may be
+ * NULL.
+ *
+ * @return Pointer to the conf_schema struct on success, NULL on failure.
+ *
+ * A schema file is a configuration file that maps each key to a rule. A rule
+ * starts with the type of the value, one of 'any', 'int', 'long', 'double',
+ * 'string' and 'char', followed by any of the following:
+ * - 'required': the key must be present.
+ * - 'min..max': the value, or the length of a string, must be in the range;
+ *   either bound may be omitted.
+ * - 'enum a|b|c': the value must be one of the given values; numbers compare
+ *   by value, so '3e9' allows 3000000000.
+ *
+ * For example, 'port = int required 1..65535'. If a rule is malformed, or a
+ * key has more than one rule, the error code is CONF_ERR_SCHEMA, and the key
+ * and line of the rule are reported. The reported key stays valid until the
+ * next failed compile in the same thread. The conf_schema struct should be
+ * freed using the conf_schema_free() function when it is no longer needed.
+ */
+conf_schema* conf_schema_compile(const char* filename, conf_error* err);
+
+/**
+ * @brief Frees the memory allocated by a conf_schema struct.
+ *
+ * @param[in] schema Pointer to the conf_schema struct to free.
+ */
+void conf_schema_free(conf_schema* schema);
+
+/**
+ * @brief Validates configuration data against a compiled schema.
+ *
+ * @param[in]  data   Pointer to the conf_data struct.
+ * @param[in]  schema Pointer to the conf_schema struct.
+ * @param[out] err    Pointer to the conf_error struct to fill in, may be NULL.
+ *
+ * @return 0 if the data satisfies all rules, -1 otherwise.
+ *
+ * All rules are checked in a single pass over the schema. @p err describes the
+ * first violated rule, including its key, and counts all violated rules.
+ */
+int conf_validate(const conf_data* data, const conf_schema* schema,
+				  conf_error* err);
+
 #endif /* LIBCONF_H */
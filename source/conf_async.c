@@ -0,0 +1,193 @@
+/**
+ * @file conf_async.c
+ * @brief Non-blocking loading of configuration files for the libconf library.
+ *
+ * Requests are queued to a single worker thread owned by the library, which
+ * reads and parses the files. Finished requests are moved to a completion list
+ * and signalled through a file descriptor, an eventfd on Linux and a pipe
+ * elsewhere, which an event loop can wait on. conf_async_dispatch() then runs
+ * the callbacks on the thread of the event loop.
+ */
+
+#include "conf_notify.h"
+#include "libconf.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Queued load request.
+ */
+typedef struct conf_request {
+	struct conf_request* next;	   /**< Next request in the same list */
+	char*				 filename; /**< Copy of the file name */
+	int					 flags;	   /**< Bitwise OR of conf_load_flags values */
+	conf_load_cb		 callback; /**< Function called once loaded */
+	void*				 ctx;	   /**< Context passed to the callback */
+	conf_data*			 data;	   /**< Loaded data, NULL on failure */
+	conf_error			 err;	   /**< Error info of the load */
+} conf_request;
+
+/**
+ * @brief FIFO list of requests.
+ */
+typedef struct {
+	conf_request*  head; /**< First request, NULL if empty */
+	conf_request** tail; /**< Link to set for the next request */
+} conf_queue;
+
+/**
+ * @brief State of the loading worker, shared by all callers.
+ */
+static struct {
+	pthread_mutex_t	lock;		/**< Protects all other members */
+	pthread_cond_t	wake;		/**< Signalled when a request is queued */
+	conf_queue		pending;	/**< Requests not yet loaded */
+	conf_queue		done;		/**< Requests waiting for their callback */
+	conf_notify		notify;		/**< Readable while requests are done */
+	int				started;	/**< Whether the worker and descriptor exist */
+} worker = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+			{NULL, &worker.pending.head}, {NULL, &worker.done.head},
+			CONF_NOTIFY_INIT, 0};
+
+/**
+ * @brief Appends a request to a list.
+ */
+static void queue_push(conf_queue* queue, conf_request* req)
+{
+	req->next	 = NULL;
+	*queue->tail = req;
+	queue->tail	 = &req->next;
+}
+
+/**
+ * @brief Removes all requests from a list, returns the first one.
+ */
+static conf_request* queue_take(conf_queue* queue)
+{
+	conf_request* head = queue->head;
+	queue->head		   = NULL;
+	queue->tail		   = &queue->head;
+	return head;
+}
+
+/**
+ * @brief Loads queued requests forever.
+ */
+static void* worker_main(void* arg)
+{
+	(void)arg; /* unused */
+
+	pthread_mutex_lock(&worker.lock);
+	for (;;) {
+		while (!worker.pending.head) {
+			pthread_cond_wait(&worker.wake, &worker.lock);
+		}
+		conf_request* req	= worker.pending.head;
+		worker.pending.head = req->next;
+		if (!worker.pending.head) worker.pending.tail = &worker.pending.head;
+		pthread_mutex_unlock(&worker.lock);
+
+		/* Read and parse without holding the lock */
+		req->data = conf_load_ex(req->filename, req->flags, &req->err);
+
+		pthread_mutex_lock(&worker.lock);
+		queue_push(&worker.done, req);
+		conf_notify_signal(&worker.notify);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Starts the worker unless it is running. Must hold the lock.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int start_worker(void)
+{
+	if (worker.started) return 0;
+	if (conf_notify_open(&worker.notify) != 0) return -1;
+
+	/* Signals such as SIGHUP are left to the threads of the application */
+	pthread_attr_t attr;
+	pthread_t	   thread;
+	sigset_t	   all;
+	sigset_t	   old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int rc = pthread_attr_init(&attr);
+	if (rc == 0) {
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		rc = pthread_create(&thread, &attr, worker_main, NULL);
+		pthread_attr_destroy(&attr);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0) {
+		conf_notify_close(&worker.notify);
+		return -1;
+	}
+
+	worker.started = 1;
+	return 0;
+}
+
+int conf_async_fd(void)
+{
+	pthread_mutex_lock(&worker.lock);
+	int fd = start_worker() == 0 ? worker.notify.read_fd : -1;
+	pthread_mutex_unlock(&worker.lock);
+	return fd;
+}
+
+int conf_load_async(const char* filename, int flags, conf_load_cb callback,
+					void* ctx)
+{
+	if (!filename || !callback) return -1;
+
+	conf_request* req = (conf_request*)calloc(1, sizeof(conf_request));
+	if (!req) return -1;
+	req->filename = strdup(filename);
+	req->flags	  = flags;
+	req->callback = callback;
+	req->ctx	  = ctx;
+	if (!req->filename) {
+		free(req);
+		return -1;
+	}
+
+	pthread_mutex_lock(&worker.lock);
+	int rc = start_worker();
+	if (rc == 0) {
+		queue_push(&worker.pending, req);
+		pthread_cond_signal(&worker.wake);
+	}
+	pthread_mutex_unlock(&worker.lock);
+
+	if (rc != 0) {
+		free(req->filename);
+		free(req);
+	}
+	return rc;
+}
+
+int conf_async_dispatch(void)
+{
+	pthread_mutex_lock(&worker.lock);
+	conf_notify_drain(&worker.notify);
+	conf_request* req = queue_take(&worker.done);
+	pthread_mutex_unlock(&worker.lock);
+
+	/* Run the callbacks without the lock, so they may queue new loads */
+	int count = 0;
+	while (req) {
+		conf_request* next = req->next;
+		req->callback(req->data, &req->err, req->ctx);
+		free(req->filename);
+		free(req);
+		req = next;
+		count++;
+	}
+	return count;
+}
@@ -0,0 +1,469 @@
+/**
+ * @file conf_batch.c
+ * @brief Batch loading of many configuration files for the libconf library.
+ *
+ * On Linux, the opens and reads of all files are submitted through an io_uring
+ * instance, so many files are in flight at once while the calling thread parses
+ * each file as soon as its last read completes. The ring is driven with the raw
+ * system calls, so no extra library is needed. If io_uring is not available,
+ * or the library is built with CONF_NO_IO_URING, a small pool of threads loads
+ * the files with conf_load_ex() instead. Both paths share the parse cache and
+ * the override journals through conf_load_file().
+ */
+
+#include "conf_load.h"
+#include "libconf.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(CONF_NO_IO_URING)
+#define CONF_IO_URING 1
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+/* Maximum number of files in flight in the io_uring instance */
+#define BATCH_QUEUE_DEPTH 64
+
+/* Maximum number of threads of the fallback pool */
+#define BATCH_MAX_THREADS 16
+
+/* Initial size of the buffer for files of unknown size */
+#define READ_CHUNK_SIZE 4096
+
+/**
+ * @brief State shared by all files of a batch.
+ */
+typedef struct {
+	const char* const* filenames; /**< Names of the files to load */
+	int				   count;	  /**< Number of files */
+	int				   flags;	  /**< Bitwise OR of conf_load_flags values */
+	conf_data**		   results;	  /**< Loaded data of each file */
+	conf_error*		   errors;	  /**< Error info of each file, or NULL */
+	int				   next;	  /**< Next file to load by the thread pool */
+} batch;
+
+/**
+ * @brief Returns the error info of a file, or NULL if not requested.
+ */
+static conf_error* batch_error(batch* b, int i)
+{
+	return b->errors ? &b->errors[i] : NULL;
+}
+
+/**
+ * @brief Records the failure of a file that could not be read.
+ */
+static void batch_fail(batch* b, int i, const char* reason)
+{
+	conf_error* err = batch_error(b, i);
+	b->results[i]	= NULL;
+	if (!err) return;
+	memset(err, 0, sizeof(*err));
+	err->code	= CONF_ERR_IO;
+	err->reason = reason;
+}
+
+/**
+ * @brief Loads files of the batch until none is left.
+ */
+static void* batch_worker(void* arg)
+{
+	batch* b = (batch*)arg;
+	for (;;) {
+		int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+		if (i >= b->count) break;
+		b->results[i] =
+			conf_load_ex(b->filenames[i], b->flags, batch_error(b, i));
+	}
+	return NULL;
+}
+
+/**
+ * @brief Loads the batch with a pool of threads and the calling thread.
+ */
+static void batch_threads(batch* b)
+{
+	long cpus	 = sysconf(_SC_NPROCESSORS_ONLN);
+	int	 threads = cpus > 1 ? (int)cpus - 1 : 0;
+	if (threads > BATCH_MAX_THREADS) threads = BATCH_MAX_THREADS;
+	if (threads > b->count - 1) threads = b->count - 1;
+
+	pthread_t pool[BATCH_MAX_THREADS];
+	int		  started = 0;
+	while (started < threads &&
+		   pthread_create(&pool[started], NULL, batch_worker, b) == 0) {
+		started++;
+	}
+
+	batch_worker(b);
+	for (int t = 0; t < started; t++) {
+		pthread_join(pool[t], NULL);
+	}
+}
+
+#ifdef CONF_IO_URING
+
+/**
+ * @brief Submission and completion rings of an io_uring instance.
+ */
+typedef struct {
+	int					 fd;		   /**< File descriptor of the instance */
+	unsigned			 entries;	   /**< Number of submission entries */
+	unsigned*			 sq_head;	   /**< Head of the submission ring */
+	unsigned*			 sq_tail;	   /**< Tail of the submission ring */
+	unsigned*			 sq_mask;	   /**< Mask of submission ring indices */
+	unsigned*			 sq_array;	   /**< Submission ring of entry indices */
+	struct io_uring_sqe* sqes;		   /**< Submission entries */
+	unsigned*			 cq_head;	   /**< Head of the completion ring */
+	unsigned*			 cq_tail;	   /**< Tail of the completion ring */
+	unsigned*			 cq_mask;	   /**< Mask of completion ring indices */
+	struct io_uring_cqe* cqes;		   /**< Completion entries */
+	void*				 sq_ring;	   /**< Mapping of the submission ring */
+	size_t				 sq_ring_size; /**< Size of the submission ring map */
+	void*				 cq_ring;	   /**< Mapping of the completion ring */
+	size_t				 cq_ring_size; /**< Size of the completion ring map */
+	size_t				 sqes_size;	   /**< Size of the submission entries */
+	unsigned			 queued;	   /**< Entries not yet submitted */
+} uring;
+
+/**
+ * @brief Read state of a file loaded through io_uring.
+ */
+typedef struct {
+	int			fd;		/**< Open file, -1 while it is being opened */
+	char*		buf;	/**< Buffer holding the contents read so far */
+	size_t		len;	/**< Number of bytes read */
+	size_t		cap;	/**< Capacity of the buffer */
+	size_t		expect; /**< Size of a regular file, 0 if unknown */
+	int			done;	/**< Whether the file is loaded or failed */
+	int			stated; /**< Whether st holds the status of the file */
+	struct stat st;		/**< Status of the file before it was read */
+} uring_file;
+
+/**
+ * @brief Unmaps the rings and closes an io_uring instance.
+ */
+static void uring_exit(uring* ring)
+{
+	if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+/**
+ * @brief Maps part of an io_uring instance, returns NULL on failure.
+ */
+static void* uring_map(int fd, size_t size, off_t offset)
+{
+	void* map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_POPULATE, fd, offset);
+	return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ * @brief Sets up an io_uring instance.
+ *
+ * @return 0 on success, -1 if io_uring is not available.
+ */
+static int uring_init(uring* ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0) return -1;
+
+	/* Reads at the current file position came with the open and read
+	 * operations, so older kernels fall back to the thread pool */
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_ring_size =
+		params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size =
+		params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	int fd		  = ring->fd;
+	ring->sq_ring = uring_map(fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+	ring->cq_ring = uring_map(fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+	ring->sqes	  = uring_map(fd, ring->sqes_size, IORING_OFF_SQES);
+	if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+		uring_exit(ring);
+		return -1;
+	}
+
+	char* sq	   = (char*)ring->sq_ring;
+	char* cq	   = (char*)ring->cq_ring;
+	ring->sq_head  = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail  = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask  = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head  = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail  = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask  = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes	   = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+/**
+ * @brief Queues a cleared submission entry for the given file.
+ *
+ * The ring never runs full, since every file has at most one operation in
+ * flight and no more files than entries are in flight.
+ */
+static struct io_uring_sqe* uring_queue(uring* ring, int i)
+{
+	unsigned			 tail  = *ring->sq_tail;
+	unsigned			 index = tail & *ring->sq_mask;
+	struct io_uring_sqe* sqe   = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data		  = (uint64_t)i;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+	return sqe;
+}
+
+/**
+ * @brief Submits the queued entries and waits for at least one completion.
+ *
+ * @param[in] ring   Pointer to the ring.
+ * @param[in] submit Nonzero to submit the queued entries, zero to only wait.
+ *
+ * @return Number of entries submitted, -1 on failure.
+ */
+static int uring_submit_and_wait(uring* ring, int submit)
+{
+	for (;;) {
+		long rc = syscall(__NR_io_uring_enter, ring->fd,
+						  submit ? ring->queued : 0, 1,
+						  IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc >= 0) {
+			ring->queued -= (unsigned)rc;
+			return (int)rc;
+		}
+		if (errno != EINTR) return -1;
+	}
+}
+
+/**
+ * @brief Queues a read of the rest of a file, growing its buffer if needed.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int uring_read(uring* ring, uring_file* file, int i)
+{
+	if (file->len == file->cap - 1) {
+		char* grown = (char*)realloc(file->buf, file->cap * 2);
+		if (!grown) return -1;
+		file->buf  = grown;
+		file->cap *= 2;
+	}
+
+	/* Read at the current position, so pipes and devices work as well */
+	struct io_uring_sqe* sqe = uring_queue(ring, i);
+	sqe->opcode				 = IORING_OP_READ;
+	sqe->fd					 = file->fd;
+	sqe->off				 = (uint64_t)-1;
+	sqe->addr				 = (uint64_t)(uintptr_t)(file->buf + file->len);
+	sqe->len				 = (uint32_t)(file->cap - file->len - 1);
+	return 0;
+}
+
+/**
+ * @brief Handles the completion of an open, and queues the first read.
+ *
+ * @return 1 if the file is done, 0 if a read is in flight.
+ */
+static int uring_opened(batch* b, uring* ring, uring_file* file, int i,
+						int res)
+{
+	if (res < 0) {
+		batch_fail(b, i, "Failed to open file");
+		return 1;
+	}
+	file->fd = res;
+
+	file->cap	 = READ_CHUNK_SIZE;
+	file->stated = fstat(file->fd, &file->st) == 0;
+	if (file->stated && S_ISREG(file->st.st_mode) && file->st.st_size > 0) {
+		file->expect = (size_t)file->st.st_size;
+		file->cap	 = file->expect + 2;
+	}
+
+	file->buf = (char*)malloc(file->cap);
+	if (!file->buf || uring_read(ring, file, i) != 0) {
+		close(file->fd);
+		free(file->buf);
+		batch_fail(b, i, "Failed to allocate memory");
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Handles the completion of a read, and parses the file once whole.
+ *
+ * @return 1 if the file is done, 0 if a read is in flight.
+ */
+static int uring_was_read(batch* b, uring* ring, uring_file* file, int i,
+						  int res)
+{
+	if (res < 0 && res != -EINTR && res != -EAGAIN) {
+		close(file->fd);
+		free(file->buf);
+		batch_fail(b, i, "Failed to read file");
+		return 1;
+	}
+	if (res > 0) file->len += (size_t)res;
+
+	/* Regular files are done once their size is read, saving a read at EOF */
+	if (res != 0 && !(file->expect && file->len == file->expect)) {
+		if (uring_read(ring, file, i) == 0) return 0;
+		close(file->fd);
+		free(file->buf);
+		batch_fail(b, i, "Failed to allocate memory");
+		return 1;
+	}
+
+	close(file->fd);
+	file->buf[file->len] = '\0';
+	b->results[i] = conf_load_file(b->filenames[i], file->buf, file->len,
+								   file->stated ? &file->st : NULL, b->flags,
+								   batch_error(b, i));
+	return 1;
+}
+
+/**
+ * @brief Handles every pending completion, each may queue the next read of a
+ * file.
+ *
+ * @param[out] reaped Number of completions handled.
+ *
+ * @return Number of files that are done.
+ */
+static int uring_reap(batch* b, uring* ring, uring_file* files, int* reaped)
+{
+	int		 done = 0;
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	*reaped		  = (int)(tail - head);
+	for (; head != tail; head++) {
+		struct io_uring_cqe* cqe  = &ring->cqes[head & *ring->cq_mask];
+		int					 i	  = (int)cqe->user_data;
+		uring_file*			 file = &files[i];
+		file->done = file->fd < 0 ? uring_opened(b, ring, file, i, cqe->res)
+								  : uring_was_read(b, ring, file, i, cqe->res);
+		done += file->done;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return done;
+}
+
+/**
+ * @brief Loads the batch through io_uring.
+ *
+ * @return 0 on success, -1 if io_uring is not available.
+ */
+static int batch_uring(batch* b)
+{
+	uring ring;
+	if (uring_init(&ring, BATCH_QUEUE_DEPTH) != 0) return -1;
+
+	uring_file* files = (uring_file*)calloc((size_t)b->count, sizeof(*files));
+	if (!files) {
+		uring_exit(&ring);
+		return -1;
+	}
+
+	int started	 = 0;
+	int done	 = 0;
+	int inflight = 0; /* Submitted operations that have not completed */
+	int reaped;
+	while (done < b->count) {
+		/* Keep as many files in flight as the ring has entries */
+		while (started < b->count && started - done < (int)ring.entries) {
+			int					 i	 = started++;
+			struct io_uring_sqe* sqe = uring_queue(&ring, i);
+			files[i].fd				 = -1;
+			sqe->opcode				 = IORING_OP_OPENAT;
+			sqe->fd					 = AT_FDCWD;
+			sqe->addr				 = (uint64_t)(uintptr_t)b->filenames[i];
+			sqe->open_flags			 = O_RDONLY | O_CLOEXEC;
+		}
+
+		int submitted = uring_submit_and_wait(&ring, 1);
+		if (submitted < 0) break;
+		inflight += submitted;
+		done	 += uring_reap(b, &ring, files, &reaped);
+		inflight -= reaped;
+	}
+
+	/*
+	 * The kernel writes into the buffers of submitted operations until they
+	 * complete, even once the ring is closed, so wait for all of them. If even
+	 * waiting fails, the buffers of unfinished files are leaked instead.
+	 */
+	int drained = 1;
+	while (done < b->count && inflight > 0) {
+		if (uring_submit_and_wait(&ring, 0) < 0) {
+			drained = 0;
+			break;
+		}
+		done	 += uring_reap(b, &ring, files, &reaped);
+		inflight -= reaped;
+	}
+	uring_exit(&ring);
+
+	/* Load the files the ring could not finish without it */
+	for (int i = 0; done < b->count && i < b->count; i++) {
+		if (files[i].done) continue;
+		if (drained) {
+			if (files[i].fd >= 0) close(files[i].fd);
+			free(files[i].buf);
+		}
+		b->results[i] =
+			conf_load_ex(b->filenames[i], b->flags, batch_error(b, i));
+	}
+	free(files);
+	return 0;
+}
+
+#endif /* CONF_IO_URING */
+
+int conf_load_batch(const char* const* filenames, int count, int flags,
+					conf_data** results, conf_error* errors)
+{
+	if (!filenames || !results || count < 0) return -1;
+
+	batch b = {filenames, count, flags, results, errors, 0};
+	memset(results, 0, (size_t)count * sizeof(*results));
+
+#ifdef CONF_IO_URING
+	if (batch_uring(&b) != 0) batch_threads(&b);
+#else
+	batch_threads(&b);
+#endif
+
+	int loaded = 0;
+	for (int i = 0; i < count; i++) {
+		if (results[i]) loaded++;
+	}
+	return loaded;
+}
@@ -0,0 +1,212 @@
+/**
+ * @file conf_cache.c
+ * @brief Parse cache for the libconf library.
+ *
+ * Cache files are named after the hash of the path of the configuration file.
+ * Each starts with a header identifying the file by device, inode, size and
+ * modification time, and the hash of its contents. A cache file is used if the
+ * identity still matches. Like the index of git, a file modified no earlier
+ * than its cache file was written is "racy": it may have changed again within
+ * the same timestamp, so its contents are hashed and compared as well.
+ *
+ * Cache files are written to a temporary file and renamed into place, so
+ * concurrent loads never see a partial cache file.
+ */
+
+#include "conf_cache.h"
+#include "conf_load.h"
+#include "conf_store.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Magic number of a cache file, and size reserved for its header */
+#define CACHE_MAGIC		  "LIBCONF\1"
+#define CACHE_HEADER_SIZE 128
+
+/* Maximum length of a cache file path */
+#define CACHE_PATH_LEN 4096
+
+/**
+ * @brief Header of a cache file, followed by the image of the store.
+ */
+typedef struct {
+	char	 magic[8];	 /**< CACHE_MAGIC */
+	uint64_t dev;		 /**< Device of the configuration file */
+	uint64_t ino;		 /**< Inode of the configuration file */
+	uint64_t size;		 /**< Size of the configuration file */
+	int64_t	 mtime_sec;	 /**< Modification time, seconds */
+	int64_t	 mtime_nsec; /**< Modification time, nanoseconds */
+	uint64_t content;	 /**< Hash of the contents of the file */
+} cache_header;
+
+_Static_assert(sizeof(cache_header) <= CACHE_HEADER_SIZE,
+			   "cache header does not fit into its reserved space");
+
+/* Current cache directory, NULL if caching is disabled */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char*		   cache_path = NULL;
+
+int conf_set_cache_dir(const char* dir)
+{
+	char* copy = NULL;
+	if (dir && !(copy = strdup(dir))) return -1;
+
+	pthread_mutex_lock(&cache_lock);
+	char* old  = cache_path;
+	cache_path = copy;
+	pthread_mutex_unlock(&cache_lock);
+
+	free(old);
+	return 0;
+}
+
+int conf_cache_dir(char* dir, size_t size)
+{
+	int rc = -1;
+	pthread_mutex_lock(&cache_lock);
+	if (cache_path && strlen(cache_path) < size) {
+		strcpy(dir, cache_path);
+		rc = 0;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return rc;
+}
+
+/**
+ * @brief Builds the path of the cache file of a configuration file.
+ *
+ * @return 0 on success, -1 if the path is too long.
+ */
+static int cache_file(char* path, const char* dir, const char* filename)
+{
+	unsigned long long hash = conf_hash(filename, NULL);
+	int n = snprintf(path, CACHE_PATH_LEN, "%s/%016llx.cache", dir, hash);
+	return n > 0 && n < CACHE_PATH_LEN ? 0 : -1;
+}
+
+/**
+ * @brief Returns a modification time in nanoseconds.
+ */
+static int64_t mtime_ns(const struct stat* st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Hashes the current contents of a file.
+ *
+ * @return 0 on success, -1 if the file cannot be read.
+ */
+static int hash_contents(const char* filename, size_t size, uint64_t* hash)
+{
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+
+	char*	buf = (char*)malloc(size ? size : 1);
+	ssize_t len = 0;
+	if (buf) {
+		while ((size_t)len < size) {
+			ssize_t n = read(fd, buf + len, size - len);
+			if (n <= 0) break;
+			len += n;
+		}
+	}
+	close(fd);
+
+	int rc = buf && (size_t)len == size ? 0 : -1;
+	if (rc == 0) *hash = conf_hash_bytes(buf, size);
+	free(buf);
+	return rc;
+}
+
+conf_data* conf_cache_load(const char* dir, const char* filename)
+{
+	char		path[CACHE_PATH_LEN];
+	struct stat st;
+	if (cache_file(path, dir, filename) != 0 || stat(filename, &st) != 0) {
+		return NULL;
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+
+	/* Map privately, so relocating the strings never writes to the file */
+	struct stat cache_st;
+	void*		image = MAP_FAILED;
+	if (fstat(fd, &cache_st) == 0 && cache_st.st_size >= CACHE_HEADER_SIZE) {
+		image = mmap(NULL, (size_t)cache_st.st_size, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (image == MAP_FAILED) return NULL;
+
+	/* The file must be the one the cache file was written for */
+	cache_header hdr;
+	size_t		 size = (size_t)cache_st.st_size;
+	memcpy(&hdr, image, sizeof(hdr));
+	int valid = memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0 &&
+				hdr.dev == (uint64_t)st.st_dev &&
+				hdr.ino == (uint64_t)st.st_ino &&
+				hdr.size == (uint64_t)st.st_size &&
+				hdr.mtime_sec == (int64_t)st.st_mtim.tv_sec &&
+				hdr.mtime_nsec == (int64_t)st.st_mtim.tv_nsec;
+
+	/* A racy file may have changed without changing its identity */
+	uint64_t content;
+	if (valid && mtime_ns(&st) >= mtime_ns(&cache_st)) {
+		valid = hash_contents(filename, (size_t)st.st_size, &content) == 0 &&
+				content == hdr.content;
+	}
+
+	conf_data* data = valid ? conf_load_image(image, size, CACHE_HEADER_SIZE)
+							: NULL;
+	if (!data) munmap(image, size);
+	return data;
+}
+
+void conf_cache_save(const char* dir, const char* filename,
+					 const struct stat* st, uint64_t content,
+					 const conf_data* data)
+{
+	char path[CACHE_PATH_LEN];
+	char temp[CACHE_PATH_LEN];
+	if (cache_file(path, dir, filename) != 0) return;
+	int n = snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+	if (n <= 0 || n >= (int)sizeof(temp)) return;
+
+	size_t size;
+	char*  image = conf_store_save(data->store, CACHE_HEADER_SIZE, &size);
+	if (!image) return;
+
+	cache_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.dev		   = (uint64_t)st->st_dev;
+	hdr.ino		   = (uint64_t)st->st_ino;
+	hdr.size	   = (uint64_t)st->st_size;
+	hdr.mtime_sec  = (int64_t)st->st_mtim.tv_sec;
+	hdr.mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+	hdr.content	   = content;
+	memcpy(image, &hdr, sizeof(hdr));
+
+	/* Write a temporary file and rename it, replacing any stale cache file */
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		size_t done = 0;
+		while (done < size) {
+			ssize_t w = write(fd, image + done, size - done);
+			if (w <= 0) break;
+			done += (size_t)w;
+		}
+		if (close(fd) != 0 || done != size || rename(temp, path) != 0) {
+			unlink(temp);
+		}
+	}
+	free(image);
+}
@@ -0,0 +1,57 @@
+/**
+ * @file conf_cache.h
+ * @brief Internal parse cache of the libconf library.
+ *
+ * When a cache directory is set, conf_load_ex() first looks for a cache file
+ * of the configuration file, and saves one after parsing it. A cache file
+ * holds the identity of the configuration file followed by the relocatable
+ * image of its store, so a hit maps the image instead of parsing the file.
+ */
+
+#ifndef CONF_CACHE_H
+#define CONF_CACHE_H
+
+#include "libconf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Copies the current cache directory.
+ *
+ * @param[out] dir  Buffer for the directory.
+ * @param[in]  size Size of the buffer.
+ *
+ * @return 0 if a cache directory is set and fits into the buffer, -1
+ * otherwise.
+ */
+int conf_cache_dir(char* dir, size_t size);
+
+/**
+ * @brief Loads a configuration file from its cache file.
+ *
+ * @param[in] dir      Cache directory.
+ * @param[in] filename Name of the configuration file.
+ *
+ * @return Pointer to the conf_data struct, NULL if the cache file is missing,
+ * stale or invalid.
+ */
+conf_data* conf_cache_load(const char* dir, const char* filename);
+
+/**
+ * @brief Saves the parsed data of a configuration file to its cache file.
+ *
+ * Failures are ignored, the next load just parses the file again.
+ *
+ * @param[in] dir      Cache directory.
+ * @param[in] filename Name of the configuration file.
+ * @param[in] st       Status of the configuration file before it was read.
+ * @param[in] content  Hash of the contents as returned by conf_hash_bytes().
+ * @param[in] data     Parsed data of the file.
+ */
+void conf_cache_save(const char* dir, const char* filename,
+					 const struct stat* st, uint64_t content,
+					 const conf_data* data);
+
+#endif /* CONF_CACHE_H */
@@ -0,0 +1,328 @@
+/**
+ * @file conf_client.c
+ * @brief Snapshots shared between processes for the libconf library.
+ *
+ * A snapshot is the relocatable image of a store in a sealed memfd. Sealing
+ * guarantees the receiver that the contents can neither change nor shrink, so
+ * it maps the memfd privately and only the relocated string values are ever
+ * copied on write. Snapshots are passed between processes with SCM_RIGHTS, as
+ * done by libconfd and its clients.
+ */
+
+#define _GNU_SOURCE
+
+#include "conf_load.h"
+#include "conf_proto.h"
+#include "conf_store.h"
+#include "conf_trie.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+#ifdef __linux__
+/* Seals every snapshot carries */
+#define SNAPSHOT_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#endif
+
+/**
+ * @brief Connection to libconfd.
+ */
+struct conf_client {
+	int				sock;	 /**< Connected socket */
+	pthread_mutex_t lock;	 /**< Protects the current snapshot */
+	conf_data*		current; /**< Current snapshot */
+};
+
+#ifdef __linux__
+/**
+ * @brief Adds a pair of a version to a store.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int add_pair(const char* key, conf_type type, conf_value value,
+					void* ctx)
+{
+	conf_store* store = (conf_store*)ctx;
+	if (type == CONF_STRING) {
+		return conf_store_add_string(store, key, strlen(key), value.str,
+									 strlen(value.str));
+	}
+	return conf_store_add(store, key, strlen(key), type, value);
+}
+
+/**
+ * @brief Copies the pairs of a version with runtime overrides into a store.
+ *
+ * @return Pointer to the store on success, NULL on allocation failure.
+ */
+static conf_store* flatten(const conf_data* data)
+{
+	conf_store* store = conf_store_new();
+	if (store && (conf_pairs_walk(data, add_pair, store) != 0 ||
+				  conf_store_finish(store) != 0)) {
+		conf_store_free(store);
+		store = NULL;
+	}
+	if (!store) errno = ENOMEM;
+	return store;
+}
+
+int conf_snapshot_fd(const conf_data* data)
+{
+	if (!data || !data->store) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Overrides live outside the store, so they are flattened into a new one */
+	conf_store* flat = NULL;
+	if (data->overrides && !(flat = flatten(data))) return -1;
+
+	size_t size;
+	char*  image = conf_store_save(flat ? flat : data->store, 0, &size);
+	conf_store_free(flat);
+	if (!image) return -1;
+
+	int fd = memfd_create("libconf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		size_t done = 0;
+		while (done < size) {
+			ssize_t w = write(fd, image + done, size - done);
+			if (w < 0 && errno == EINTR) continue;
+			if (w <= 0) break;
+			done += (size_t)w;
+		}
+		if (done != size || fcntl(fd, F_ADD_SEALS, SNAPSHOT_SEALS) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	free(image);
+	return fd;
+}
+
+conf_data* conf_snapshot_map(int fd)
+{
+	/* Only sealed snapshots are safe to map without copying */
+	struct stat st;
+	int			seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & SNAPSHOT_SEALS) != SNAPSHOT_SEALS ||
+		fstat(fd, &st) != 0 || st.st_size <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t size	 = (size_t)st.st_size;
+	void*  image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (image == MAP_FAILED) return NULL;
+
+	conf_data* data = conf_load_image(image, size, 0);
+	if (!data) {
+		munmap(image, size);
+		errno = EINVAL;
+	}
+	return data;
+}
+#else
+int conf_snapshot_fd(const conf_data* data)
+{
+	(void)data; /* unused */
+
+	/* Snapshots need sealed memfds */
+	errno = ENOSYS;
+	return -1;
+}
+
+conf_data* conf_snapshot_map(int fd)
+{
+	(void)fd; /* unused */
+
+	errno = ENOSYS;
+	return NULL;
+}
+#endif
+
+int conf_proto_send(int sock, conf_error_code status, int fd)
+{
+	unsigned char byte = (unsigned char)status;
+	struct iovec  iov  = {&byte, 1};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov	   = &iov;
+	msg.msg_iovlen = 1;
+
+	/* Attach the descriptor to successful replies */
+	union {
+		struct cmsghdr hdr;
+		char		   buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	if (status == CONF_OK) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control			   = control.buf;
+		msg.msg_controllen		   = sizeof(control.buf);
+		struct cmsghdr* cmsg	   = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level		   = SOL_SOCKET;
+		cmsg->cmsg_type			   = SCM_RIGHTS;
+		cmsg->cmsg_len			   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t rc;
+	do {
+		rc = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	return rc == 1 ? 0 : -1;
+}
+
+int conf_proto_recv(int sock, conf_error_code* status, int* fd)
+{
+	unsigned char byte;
+	struct iovec  iov = {&byte, 1};
+	union {
+		struct cmsghdr hdr;
+		char		   buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov		   = &iov;
+	msg.msg_iovlen	   = 1;
+	msg.msg_control	   = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t rc;
+	do {
+		rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+	if (rc != 1) return -1;
+
+	*status				 = (conf_error_code)byte;
+	*fd					 = -1;
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+		cmsg->cmsg_type == SCM_RIGHTS) {
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	return 1;
+}
+
+/**
+ * @brief Maps a received snapshot and makes it the current one.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int client_publish(conf_client* client, conf_error_code status, int fd)
+{
+	conf_data* data = status == CONF_OK && fd >= 0 ? conf_snapshot_map(fd)
+												   : NULL;
+	if (fd >= 0) close(fd);
+	if (!data) return -1;
+
+	pthread_mutex_lock(&client->lock);
+	conf_data* old	= client->current;
+	client->current = data;
+	pthread_mutex_unlock(&client->lock);
+	conf_free(old);
+	return 0;
+}
+
+conf_client* conf_client_connect(const char* socket_path, const char* filename,
+								 conf_error* err)
+{
+	conf_error local;
+	if (!err) err = &local;
+	memset(err, 0, sizeof(*err));
+	err->code	= CONF_ERR_IO;
+	err->reason = "Failed to connect to the daemon";
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (!socket_path || !filename ||
+		strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return NULL;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	conf_client* client = (conf_client*)calloc(1, sizeof(conf_client));
+	if (!client) {
+		err->code	= CONF_ERR_MEMORY;
+		err->reason = "Failed to allocate memory";
+		return NULL;
+	}
+	pthread_mutex_init(&client->lock, NULL);
+
+	/* Request the file and wait for its first snapshot */
+	conf_error_code status = CONF_ERR_IO;
+	int				fd	   = -1;
+	client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (client->sock >= 0 &&
+		connect(client->sock, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+		send(client->sock, filename, strlen(filename) + 1, MSG_NOSIGNAL) > 0 &&
+		conf_proto_recv(client->sock, &status, &fd) == 1) {
+		err->reason = "Failed to load the file in the daemon";
+		if (status != CONF_OK) err->code = status;
+		if (client_publish(client, status, fd) == 0) {
+			fcntl(client->sock, F_SETFL,
+				  fcntl(client->sock, F_GETFL) | O_NONBLOCK);
+			err->code	= CONF_OK;
+			err->reason = NULL;
+			return client;
+		}
+	}
+
+	conf_client_close(client);
+	return NULL;
+}
+
+void conf_client_close(conf_client* client)
+{
+	if (!client) return;
+
+	if (client->sock >= 0) close(client->sock);
+	conf_free(client->current);
+	pthread_mutex_destroy(&client->lock);
+	free(client);
+}
+
+int conf_client_fd(const conf_client* client)
+{
+	return client->sock;
+}
+
+int conf_client_update(conf_client* client)
+{
+	int updated = 0;
+	for (;;) {
+		conf_error_code status;
+		int				fd;
+		int				rc = conf_proto_recv(client->sock, &status, &fd);
+		if (rc == 0) return updated;
+		if (rc < 0) return -1;
+		if (client_publish(client, status, fd) == 0) updated = 1;
+	}
+}
+
+conf_data* conf_client_acquire(conf_client* client)
+{
+	pthread_mutex_lock(&client->lock);
+	conf_data* data = conf_retain(client->current);
+	pthread_mutex_unlock(&client->lock);
+	return data;
+}
@@ -0,0 +1,348 @@
+/**
+ * @file conf_handle.c
+ * @brief Reloadable configuration handles for the libconf library.
+ *
+ * A handle owns a reference to the current snapshot of a configuration file.
+ * Publishing a snapshot swaps the reference under a short lock, bumps the
+ * generation, and signals the notification descriptor. Readers take their own
+ * reference, so a snapshot stays valid while it is in use, however many
+ * snapshots are published in the meantime.
+ *
+ * A handle may retain the last snapshots it replaced in a ring. Snapshots
+ * derived with conf_set() share most of their memory, and reloaded ones are
+ * compact stores, so the ring is cheap to keep. Rolling back republishes a
+ * retained snapshot, which takes constant time.
+ *
+ * Threads waiting for a new snapshot block in the kernel. On Linux they wait
+ * on a futex over the low 32 bits of the generation, and publishing wakes them
+ * only if any are waiting. Elsewhere they wait on a condition variable.
+ */
+
+#include "conf_handle.h"
+#include "conf_notify.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Reloadable configuration handle.
+ */
+struct conf_handle {
+	pthread_mutex_t lock;		/**< Protects the snapshot and descriptor */
+	conf_data*		current;	/**< Current snapshot */
+	unsigned long	generation; /**< Generation of the current snapshot */
+	char*			filename;	/**< Copy of the configuration file name */
+	int				flags;		/**< Flags to load the file with */
+	conf_notify		notify;		/**< Signalled for every snapshot */
+	conf_data**		history;	/**< Ring of replaced snapshots */
+	int				depth;		/**< Capacity of the ring */
+	int				retained;	/**< Number of snapshots in the ring */
+	int				next;		/**< Position of the next snapshot in the ring */
+#ifdef __linux__
+	uint32_t		futex;		/**< Low 32 bits of the generation */
+	uint32_t		waiters;	/**< Number of threads waiting on the futex */
+#else
+	pthread_cond_t	changed;	/**< Broadcast for every snapshot */
+#endif
+};
+
+conf_handle* conf_handle_create(const char* filename, int flags,
+								conf_error* err)
+{
+	conf_data* data = conf_load_ex(filename, flags, err);
+	if (!data) return NULL;
+
+	conf_handle* handle = (conf_handle*)calloc(1, sizeof(conf_handle));
+	if (handle) handle->filename = strdup(filename);
+	if (!handle || !handle->filename) {
+		free(handle);
+		conf_free(data);
+		if (err) {
+			memset(err, 0, sizeof(*err));
+			err->code	= CONF_ERR_MEMORY;
+			err->reason = "Failed to allocate memory";
+		}
+		return NULL;
+	}
+
+	pthread_mutex_init(&handle->lock, NULL);
+#ifdef __linux__
+	handle->futex = 1;
+#else
+	pthread_cond_init(&handle->changed, NULL);
+#endif
+	handle->current	   = data;
+	handle->generation = 1;
+	handle->flags	   = flags;
+	handle->notify	   = (conf_notify)CONF_NOTIFY_INIT;
+	return handle;
+}
+
+void conf_handle_free(conf_handle* handle)
+{
+	if (!handle) return;
+
+	conf_notify_close(&handle->notify);
+	conf_free(handle->current);
+	for (int i = 0; i < handle->retained; i++) {
+		conf_free(handle->history[i]);
+	}
+	free(handle->history);
+#ifndef __linux__
+	pthread_cond_destroy(&handle->changed);
+#endif
+	pthread_mutex_destroy(&handle->lock);
+	free(handle->filename);
+	free(handle);
+}
+
+/**
+ * @brief Returns the position of the snapshot retained @p back publishes ago.
+ */
+static int history_slot(const conf_handle* handle, int back)
+{
+	return (handle->next - back + handle->depth) % handle->depth;
+}
+
+/**
+ * @brief Retains a replaced snapshot, the lock of the handle must be held.
+ *
+ * @return Snapshot dropped from the ring, to be freed once the lock is
+ * released.
+ */
+static conf_data* retain_locked(conf_handle* handle, conf_data* old)
+{
+	if (handle->depth == 0) return old;
+
+	conf_data* dropped =
+		handle->retained == handle->depth ? handle->history[handle->next] : NULL;
+	handle->history[handle->next] = old;
+	handle->next				  = (handle->next + 1) % handle->depth;
+	if (handle->retained < handle->depth) handle->retained++;
+	return dropped;
+}
+
+/**
+ * @brief Makes a snapshot the current one, the lock of the handle must be held.
+ *
+ * @return Snapshot to be freed once the lock is released.
+ */
+static conf_data* publish_locked(conf_handle* handle, conf_data* data,
+								 unsigned long* generation)
+{
+	conf_data* old	= retain_locked(handle, handle->current);
+	*generation		= handle->generation + 1;
+	handle->current = data;
+	__atomic_store_n(&handle->generation, *generation, __ATOMIC_RELEASE);
+	conf_notify_signal(&handle->notify);
+#ifdef __linux__
+	/* Waiters register before they sleep, so none can miss the new word */
+	__atomic_store_n(&handle->futex, (uint32_t)*generation, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&handle->waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &handle->futex, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL,
+				NULL, 0);
+	}
+#else
+	pthread_cond_broadcast(&handle->changed);
+#endif
+	return old;
+}
+
+unsigned long conf_handle_publish(conf_handle* handle, conf_data* data)
+{
+	unsigned long generation;
+	pthread_mutex_lock(&handle->lock);
+	conf_data* old = publish_locked(handle, data, &generation);
+	pthread_mutex_unlock(&handle->lock);
+
+	/* Readers may still hold the old snapshot, it is freed with the last */
+	conf_free(old);
+	return generation;
+}
+
+unsigned long conf_handle_update(conf_handle* handle, conf_update_fn update,
+								 void* ctx)
+{
+	unsigned long generation = 0;
+	conf_data*	  old		 = NULL;
+	pthread_mutex_lock(&handle->lock);
+	conf_data* data = update(handle->current, ctx);
+	if (data) old = publish_locked(handle, data, &generation);
+	pthread_mutex_unlock(&handle->lock);
+
+	conf_free(old);
+	return generation;
+}
+
+int conf_handle_set_history(conf_handle* handle, int depth)
+{
+	if (depth < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	conf_data** history = NULL;
+	if (depth > 0) {
+		history = (conf_data**)calloc((size_t)depth, sizeof(conf_data*));
+		if (!history) return -1;
+	}
+
+	/* Keep the newest snapshots, oldest first, and drop the others */
+	pthread_mutex_lock(&handle->lock);
+	conf_data** old		 = handle->history;
+	int			retained = handle->retained;
+	int			keep	 = retained < depth ? retained : depth;
+	for (int i = 0; i < retained; i++) {
+		conf_data** entry = &old[history_slot(handle, retained - i)];
+		if (i >= retained - keep) {
+			history[i - (retained - keep)] = *entry;
+			*entry						   = NULL;
+		}
+	}
+	int old_depth	 = handle->depth;
+	handle->history	 = history;
+	handle->depth	 = depth;
+	handle->retained = keep;
+	handle->next	 = depth ? keep % depth : 0;
+	pthread_mutex_unlock(&handle->lock);
+
+	for (int i = 0; i < old_depth; i++) {
+		conf_free(old[i]);
+	}
+	free(old);
+	return 0;
+}
+
+unsigned long conf_rollback(conf_handle* handle, int generations)
+{
+	unsigned long generation = 0;
+	conf_data*	  old		 = NULL;
+	pthread_mutex_lock(&handle->lock);
+	if (generations >= 1 && generations <= handle->retained) {
+		conf_data* data =
+			conf_retain(handle->history[history_slot(handle, generations)]);
+		old = publish_locked(handle, data, &generation);
+	}
+	pthread_mutex_unlock(&handle->lock);
+
+	if (!generation) errno = EINVAL;
+	conf_free(old);
+	return generation;
+}
+
+int conf_handle_reload(conf_handle* handle, conf_error* err)
+{
+	/* Load without the lock, readers keep using the current snapshot */
+	conf_data* data = conf_load_ex(handle->filename, handle->flags, err);
+	if (!data) return -1;
+
+	conf_handle_publish(handle, data);
+	return 0;
+}
+
+conf_data* conf_handle_acquire(conf_handle* handle)
+{
+	pthread_mutex_lock(&handle->lock);
+	conf_data* data = conf_retain(handle->current);
+	pthread_mutex_unlock(&handle->lock);
+	return data;
+}
+
+unsigned long conf_handle_generation(const conf_handle* handle)
+{
+	return __atomic_load_n(&handle->generation, __ATOMIC_ACQUIRE);
+}
+
+int conf_handle_notify_fd(conf_handle* handle)
+{
+	pthread_mutex_lock(&handle->lock);
+	if (handle->notify.read_fd < 0) conf_notify_open(&handle->notify);
+	int fd = handle->notify.read_fd;
+	pthread_mutex_unlock(&handle->lock);
+	return fd;
+}
+
+/**
+ * @brief Returns the time left until a deadline in milliseconds, at least 0.
+ */
+static long time_left(const struct timespec* deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+			  (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+int conf_wait_for_change(conf_handle* handle, unsigned long last_generation,
+						 int timeout_ms)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec	 += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+#ifdef __linux__
+	for (;;) {
+		/* Read the word first, so a publish after the check fails the wait */
+		uint32_t word = __atomic_load_n(&handle->futex, __ATOMIC_SEQ_CST);
+		if (conf_handle_generation(handle) != last_generation) return 1;
+
+		struct timespec	 timeout;
+		struct timespec* wait = NULL;
+		if (timeout_ms >= 0) {
+			long ms = time_left(&deadline);
+			if (ms == 0) return 0;
+			timeout.tv_sec	= ms / 1000;
+			timeout.tv_nsec = (ms % 1000) * 1000000;
+			wait			= &timeout;
+		}
+
+		__atomic_add_fetch(&handle->waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &handle->futex, FUTEX_WAIT_PRIVATE, word, wait,
+				NULL, 0);
+		__atomic_sub_fetch(&handle->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+#else
+	int changed = 0;
+	pthread_mutex_lock(&handle->lock);
+	for (;;) {
+		changed = handle->generation != last_generation;
+		if (changed) break;
+		if (timeout_ms < 0) {
+			pthread_cond_wait(&handle->changed, &handle->lock);
+			continue;
+		}
+
+		/* Condition variables time out on the realtime clock */
+		long ms = time_left(&deadline);
+		if (ms == 0) break;
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec  += ms / 1000;
+		until.tv_nsec += (ms % 1000) * 1000000;
+		if (until.tv_nsec >= 1000000000) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&handle->changed, &handle->lock, &until);
+	}
+	pthread_mutex_unlock(&handle->lock);
+	return changed;
+#endif
+}
@@ -0,0 +1,39 @@
+/**
+ * @file conf_handle.h
+ * @brief Internal interface of reloadable configuration handles.
+ *
+ * Besides publishing whole snapshots, a handle can derive the next snapshot
+ * from the current one while holding its lock, so concurrent publishers never
+ * overwrite each other's changes.
+ */
+
+#ifndef CONF_HANDLE_H
+#define CONF_HANDLE_H
+
+#include "libconf.h"
+
+/**
+ * @brief Derives the next snapshot of a handle from the current one.
+ *
+ * @param[in] current Current snapshot, borrowed for the duration of the call.
+ * @param[in] ctx     Context given to conf_handle_update().
+ *
+ * @return New snapshot, whose reference the handle takes over, or NULL to keep
+ * the current snapshot.
+ */
+typedef conf_data* (*conf_update_fn)(conf_data* current, void* ctx);
+
+/**
+ * @brief Derives and publishes the next snapshot of a handle atomically.
+ *
+ * @param[in] handle Pointer to the handle.
+ * @param[in] update Function deriving the next snapshot, called with the lock
+ *                   of the handle held.
+ * @param[in] ctx    Context to pass to @p update.
+ *
+ * @return Generation of the published snapshot, 0 if @p update returned NULL.
+ */
+unsigned long conf_handle_update(conf_handle* handle, conf_update_fn update,
+								 void* ctx);
+
+#endif /* CONF_HANDLE_H */
@@ -0,0 +1,532 @@
+/**
+ * @file conf_journal.c
+ * @brief Durable runtime overrides for the libconf library.
+ *
+ * Overrides are appended to a journal next to the configuration file, named
+ * after it with the suffix ".journal". The journal starts with a magic string
+ * and holds one record per change: a header with a checksum, the operation,
+ * the type and the lengths, followed by the key and the value. Appending a
+ * change is a single write followed by fdatasync(). A crash may leave a partial
+ * record at the end, which fails its checksum; loading ignores it, and opening
+ * the journal for writing cuts it off.
+ *
+ * conf_load_ex() replays the journal on top of the loaded file with conf_set()
+ * and conf_remove(). Compaction never touches the configuration file: it keeps
+ * only the last record of each key, writes them to a new journal and renames
+ * it over the old one, so a crash leaves either journal and both yield the
+ * same data. Values keep the types they were journaled with.
+ */
+
+#include "conf_load.h"
+#include "conf_store.h"
+#include "conf_trie.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Magic string at the start of every journal */
+#define JOURNAL_MAGIC	  "CONFJRN1"
+#define JOURNAL_MAGIC_LEN (sizeof(JOURNAL_MAGIC) - 1)
+
+/* Suffix of the journal of a configuration file */
+#define JOURNAL_SUFFIX ".journal"
+
+/* Operations of journal records */
+#define JOURNAL_SET	   1
+#define JOURNAL_REMOVE 2
+
+/**
+ * @brief Header of a journal record, followed by the key and the value.
+ */
+typedef struct {
+	uint64_t check;		/**< conf_hash_bytes() of the rest of the record */
+	uint32_t value_len; /**< Length of the value */
+	uint16_t key_len;	/**< Length of the key */
+	uint8_t	 op;		/**< JOURNAL_SET or JOURNAL_REMOVE */
+	uint8_t	 type;		/**< Type of the value */
+} journal_record;
+
+/**
+ * @brief Journal of a configuration file opened for appending.
+ */
+struct conf_journal {
+	int	   fd;			 /**< Journal, opened with O_APPEND */
+	int	   flags;		 /**< conf_load_flags the file is loaded with */
+	char*  filename;	 /**< Copy of the configuration file name */
+	off_t  size;		 /**< Size of the valid part of the journal */
+	size_t compact_size; /**< Size that triggers compaction, 0 for never */
+	off_t  compacted;	 /**< Size after the last compaction */
+};
+
+/**
+ * @brief Builds the name of the journal of a configuration file.
+ *
+ * @return 0 on success, -1 if the name does not fit into PATH_MAX bytes.
+ */
+static int journal_path(char* path, const char* filename)
+{
+	int n = snprintf(path, PATH_MAX, "%s" JOURNAL_SUFFIX, filename);
+	if (n <= 0 || n >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Reads a whole file into a buffer with one spare byte.
+ *
+ * @return Pointer to the buffer on success, NULL on failure.
+ */
+static char* read_all(int fd, size_t* size)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return NULL;
+
+	char* buf = (char*)malloc((size_t)st.st_size + 1);
+	if (!buf) return NULL;
+
+	size_t len = 0;
+	while (len < (size_t)st.st_size) {
+		ssize_t n = pread(fd, buf + len, (size_t)st.st_size - len, (off_t)len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		len += (size_t)n;
+	}
+	*size = len;
+	return buf;
+}
+
+/**
+ * @brief Checks the record at an offset of a journal.
+ *
+ * @return Length of the record, 0 if it is partial or corrupt.
+ */
+static size_t record_at(const char* buf, size_t size, size_t off,
+						journal_record* rec)
+{
+	if (size - off < sizeof(*rec)) return 0;
+	memcpy(rec, buf + off, sizeof(*rec));
+
+	size_t len = sizeof(*rec) + rec->key_len + (size_t)rec->value_len;
+	if (len > size - off || rec->key_len == 0 || rec->key_len >= MAX_KEY_LEN ||
+		conf_hash_bytes(buf + off + sizeof(rec->check),
+						len - sizeof(rec->check)) != rec->check) {
+		return 0;
+	}
+	if (rec->op == JOURNAL_SET &&
+		(rec->type > CONF_CHAR ||
+		 (rec->type != CONF_STRING && rec->value_len != sizeof(conf_value)))) {
+		return 0;
+	}
+	return rec->op == JOURNAL_SET || rec->op == JOURNAL_REMOVE ? len : 0;
+}
+
+/**
+ * @brief Returns the length of the valid part of a journal.
+ */
+static size_t journal_valid(const char* buf, size_t size)
+{
+	journal_record rec;
+	size_t		   off = JOURNAL_MAGIC_LEN;
+	for (size_t len; (len = record_at(buf, size, off, &rec)) != 0;) {
+		off += len;
+	}
+	return off;
+}
+
+int conf_journal_replay(const char* filename, conf_data** data)
+{
+	char path[PATH_MAX];
+	if (journal_path(path, filename) != 0) return 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return errno == ENOENT ? 0 : -1;
+
+	size_t size;
+	char*  buf = read_all(fd, &size);
+	close(fd);
+	if (!buf) return -1;
+
+	/* Files that are not journals are ignored */
+	int rc = 0;
+	if (size < JOURNAL_MAGIC_LEN ||
+		memcmp(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0) {
+		size = 0;
+	}
+
+	journal_record rec;
+	size_t		   len;
+	for (size_t off = JOURNAL_MAGIC_LEN;
+		 size && (len = record_at(buf, size, off, &rec)) != 0; off += len) {
+		char key[MAX_KEY_LEN];
+		memcpy(key, buf + off + sizeof(rec), rec.key_len);
+		key[rec.key_len] = '\0';
+
+		conf_data* next;
+		char*	   value = buf + off + sizeof(rec) + rec.key_len;
+		if (rec.op == JOURNAL_REMOVE) {
+			next = conf_remove(*data, key);
+		} else if (rec.type == CONF_STRING) {
+			/* Terminate the string in place for the duration of the call */
+			char saved			  = value[rec.value_len];
+			value[rec.value_len] = '\0';
+			conf_value v;
+			v.str				 = value;
+			next				 = conf_set(*data, key, CONF_STRING, v);
+			value[rec.value_len] = saved;
+		} else {
+			conf_value v;
+			memcpy(&v, value, sizeof(v));
+			next = conf_set(*data, key, (conf_type)rec.type, v);
+		}
+		if (!next) {
+			rc = -1;
+			break;
+		}
+		conf_free(*data);
+		*data = next;
+	}
+
+	free(buf);
+	return rc;
+}
+
+conf_journal* conf_journal_open(const char* filename, int flags,
+								size_t compact_size)
+{
+	char path[PATH_MAX];
+	if (!filename || journal_path(path, filename) != 0) return NULL;
+
+	conf_journal* journal = (conf_journal*)calloc(1, sizeof(conf_journal));
+	if (!journal) return NULL;
+	journal->flags		  = flags;
+	journal->compact_size = compact_size;
+	journal->filename	  = strdup(filename);
+	journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (!journal->filename || journal->fd < 0) {
+		conf_journal_close(journal);
+		return NULL;
+	}
+
+	/* Start new journals, and cut off a partial record of a crash */
+	size_t size;
+	char*  buf = read_all(journal->fd, &size);
+	if (!buf) {
+		conf_journal_close(journal);
+		return NULL;
+	}
+	int rc = 0;
+	if (size == 0) {
+		rc = write(journal->fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) ==
+					 (ssize_t)JOURNAL_MAGIC_LEN
+				 ? fdatasync(journal->fd)
+				 : -1;
+		size = JOURNAL_MAGIC_LEN;
+	} else if (size < JOURNAL_MAGIC_LEN ||
+			   memcmp(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0) {
+		errno = EINVAL;
+		rc	  = -1;
+	} else if (journal_valid(buf, size) < size) {
+		size = journal_valid(buf, size);
+		rc	 = ftruncate(journal->fd, (off_t)size);
+	}
+	free(buf);
+	if (rc != 0) {
+		conf_journal_close(journal);
+		return NULL;
+	}
+
+	journal->size = (off_t)size;
+	return journal;
+}
+
+void conf_journal_close(conf_journal* journal)
+{
+	if (!journal) return;
+
+	if (journal->fd >= 0) close(journal->fd);
+	free(journal->filename);
+	free(journal);
+}
+
+/**
+ * @brief Checks that a key can be journaled and is one the dialect of the
+ * file could hold.
+ *
+ * @return Length of the key, 0 if it is invalid.
+ */
+static size_t check_key(const char* key, int flags)
+{
+	size_t len = key ? strlen(key) : 0;
+	if (len == 0 || len >= MAX_KEY_LEN) return 0;
+
+	/* JSON keys are quoted, so they may hold any character */
+	if (flags & CONF_JSON) return len;
+	if (strpbrk(key, "=#\r\n") || key[0] == ' ' || key[0] == '\t' ||
+		key[len - 1] == ' ' || key[len - 1] == '\t') {
+		return 0;
+	}
+	return len;
+}
+
+/**
+ * @brief Appends a record to a journal and syncs it.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+static int journal_append(conf_journal* journal, int op, const char* key,
+						  conf_type type, conf_value value)
+{
+	size_t key_len = journal ? check_key(key, journal->flags) : 0;
+	if (key_len == 0 ||
+		(op == JOURNAL_SET && type == CONF_STRING && !value.str)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Store numbers as conf_set() does, so replays see the same types */
+	if (type == CONF_INT) {
+		value.lval = value.ival;
+		type	   = CONF_LONG;
+	} else if (type == CONF_FLOAT) {
+		value.dval = value.fval;
+		type	   = CONF_DOUBLE;
+	}
+
+	size_t value_len = 0;
+	if (op == JOURNAL_SET) {
+		value_len = type == CONF_STRING ? strlen(value.str) : sizeof(value);
+	}
+	if (value_len > UINT32_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	journal_record rec;
+	size_t		   len = sizeof(rec) + key_len + value_len;
+	char*		   buf = (char*)malloc(len);
+	if (!buf) return -1;
+	rec.value_len = (uint32_t)value_len;
+	rec.key_len	  = (uint16_t)key_len;
+	rec.op		  = (uint8_t)op;
+	rec.type	  = (uint8_t)type;
+	memcpy(buf + sizeof(rec), key, key_len);
+	if (op == JOURNAL_SET) {
+		memcpy(buf + sizeof(rec) + key_len,
+			   type == CONF_STRING ? (const void*)value.str : &value, value_len);
+	}
+	memcpy(buf, &rec, sizeof(rec));
+	rec.check = conf_hash_bytes(buf + sizeof(rec.check),
+								len - sizeof(rec.check));
+	memcpy(buf, &rec, sizeof(rec));
+
+	/* A single write, so concurrent readers never see a partial record */
+	ssize_t w = write(journal->fd, buf, len);
+	free(buf);
+	if (w != (ssize_t)len) {
+		if (w >= 0) errno = EIO;
+		int saved = errno;
+		if (ftruncate(journal->fd, journal->size) != 0) {
+			/* The partial record fails its checksum anyway */
+		}
+		errno = saved;
+		return -1;
+	}
+	journal->size += (off_t)len;
+	if (fdatasync(journal->fd) != 0) return -1;
+
+	/*
+	 * Compact once the journal exceeds its limit and has doubled since the last
+	 * compaction, so a journal of many distinct keys is not rewritten on every
+	 * change. The change is already durable, so a failed compaction is simply
+	 * retried with the next one.
+	 */
+	if (journal->compact_size &&
+		(size_t)journal->size > journal->compact_size &&
+		journal->size > 2 * journal->compacted) {
+		conf_journal_compact(journal);
+	}
+	return 0;
+}
+
+int conf_journal_set(conf_journal* journal, const char* key, conf_type type,
+					 conf_value value)
+{
+	return journal_append(journal, JOURNAL_SET, key, type, value);
+}
+
+int conf_journal_remove(conf_journal* journal, const char* key)
+{
+	conf_value none;
+	memset(&none, 0, sizeof(none));
+	return journal_append(journal, JOURNAL_REMOVE, key, CONF_STRING, none);
+}
+
+/**
+ * @brief Syncs the directory holding a file, so a rename in it is durable.
+ */
+static void sync_dir(const char* filename)
+{
+	char		dir[PATH_MAX];
+	const char* slash = strrchr(filename, '/');
+	size_t		len	  = slash ? (size_t)(slash - filename) : 0;
+	if (len >= sizeof(dir)) return;
+	memcpy(dir, filename, len);
+	strcpy(dir + len, slash ? (len ? "" : "/") : ".");
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return;
+	if (fsync(fd) != 0) {
+		/* The rename may not survive a crash, the old journal is still valid */
+	}
+	close(fd);
+}
+
+/**
+ * @brief Copies the last record of each key of a journal into a buffer.
+ *
+ * Records are visited from the last to the first, and a hash set of the keys
+ * seen so far drops all earlier records of the same key. The kept records
+ * stay in their original order.
+ *
+ * @param[in]  buf  Valid part of the journal, starting with the magic string.
+ * @param[in]  size Size of the valid part.
+ * @param[out] out  Buffer of at least @p size bytes for the new journal.
+ *
+ * @return Size of the new journal, 0 on allocation failure.
+ */
+static size_t journal_dedup(const char* buf, size_t size, char* out)
+{
+	/* Offsets of all records, each record is at least a header long */
+	size_t count = 0;
+	size_t cap	 = (size - JOURNAL_MAGIC_LEN) / sizeof(journal_record) + 1;
+	size_t slots = 16;
+	while (slots < 2 * cap) slots *= 2;
+	size_t* offsets = (size_t*)malloc(cap * sizeof(size_t));
+	size_t* set		= (size_t*)calloc(slots, sizeof(size_t));
+	char*	keep	= (char*)calloc(cap, 1);
+	if (!offsets || !set || !keep) {
+		free(offsets);
+		free(set);
+		free(keep);
+		return 0;
+	}
+
+	journal_record rec;
+	size_t		   len;
+	for (size_t off = JOURNAL_MAGIC_LEN;
+		 (len = record_at(buf, size, off, &rec)) != 0; off += len) {
+		offsets[count++] = off;
+	}
+
+	/* The set holds record offsets plus one, 0 marks a free slot */
+	for (size_t i = count; i-- > 0;) {
+		memcpy(&rec, buf + offsets[i], sizeof(rec));
+		const char* key	 = buf + offsets[i] + sizeof(rec);
+		size_t		slot = conf_hash_bytes(key, rec.key_len) & (slots - 1);
+		for (; set[slot]; slot = (slot + 1) & (slots - 1)) {
+			journal_record other;
+			memcpy(&other, buf + set[slot] - 1, sizeof(other));
+			if (other.key_len == rec.key_len &&
+				memcmp(buf + set[slot] - 1 + sizeof(other), key,
+					   rec.key_len) == 0) {
+				break;
+			}
+		}
+		if (!set[slot]) {
+			set[slot] = offsets[i] + 1;
+			keep[i]	  = 1;
+		}
+	}
+
+	size_t used = JOURNAL_MAGIC_LEN;
+	memcpy(out, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN);
+	for (size_t i = 0; i < count; i++) {
+		if (!keep[i]) continue;
+		len = record_at(buf, size, offsets[i], &rec);
+		memcpy(out + used, buf + offsets[i], len);
+		used += len;
+	}
+
+	free(offsets);
+	free(set);
+	free(keep);
+	return used;
+}
+
+/**
+ * @brief Writes a whole buffer to a descriptor.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int write_all(int fd, const char* buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buf += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int conf_journal_compact(conf_journal* journal)
+{
+	char path[PATH_MAX];
+	char temp[PATH_MAX];
+	if (journal_path(path, journal->filename) != 0) return -1;
+	int n = snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+	if (n <= 0 || n >= (int)sizeof(temp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	/* Only the valid part of the journal is kept */
+	struct stat st;
+	size_t		size;
+	char*		buf = read_all(journal->fd, &size);
+	if (!buf) return -1;
+	if (size > (size_t)journal->size) size = (size_t)journal->size;
+	char*  out = (char*)malloc(size);
+	size_t len = out ? journal_dedup(buf, size, out) : 0;
+	free(buf);
+	if (len == 0) {
+		free(out);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* Replace the journal, readers see either journal with the same data */
+	int fd = fstat(journal->fd, &st) == 0
+				 ? open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+						st.st_mode & 07777)
+				 : -1;
+	int rc = fd >= 0 ? 0 : -1;
+	if (fd >= 0) {
+		if (write_all(fd, out, len) != 0 || fsync(fd) != 0) rc = -1;
+		close(fd);
+		if (rc == 0) rc = rename(temp, path);
+		if (rc != 0) unlink(temp);
+	}
+	free(out);
+	if (rc != 0) return -1;
+	sync_dir(path);
+
+	/* Append to the new journal from now on */
+	fd = open(path, O_RDWR | O_APPEND | O_CLOEXEC);
+	if (fd < 0) return -1;
+	close(journal->fd);
+	journal->fd		   = fd;
+	journal->size	   = (off_t)len;
+	journal->compacted = (off_t)len;
+	return 0;
+}
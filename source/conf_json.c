@@ -0,0 +1,650 @@
+/**
+ * @file conf_json.c
+ * @brief JSON import of the libconf library.
+ *
+ * conf_load_ex() with CONF_JSON parses the loaded buffer as a JSON document
+ * instead of Key=Value lines. The document is tokenized in a single pass
+ * without building a tree: every scalar is added to the store as soon as it is
+ * read, under the path of its enclosing members and elements flattened into a
+ * key such as "server.listen[0].port". The path is kept in one buffer that
+ * grows and shrinks as objects and arrays are entered and left.
+ *
+ * Strings are decoded in place and kept as spans of the loaded buffer, like
+ * quoted values of Key=Value files. Numbers are typed as in Key=Value files,
+ * true and false become strings, and null values are skipped. Syntax errors
+ * always fail the load, since a stream cannot be resynchronized; keys that are
+ * empty or too long are skipped unless CONF_STRICT is set.
+ *
+ * conf_write_json() streams the pairs of a version the other way, as a flat
+ * object, through a fixed-size chunk buffer.
+ */
+
+#include "conf_load.h"
+#include "conf_store.h"
+#include "conf_trie.h"
+#include "libconf.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum nesting depth of objects and arrays */
+#define JSON_MAX_DEPTH 512
+
+/* Size of the chunks passed to the write callback */
+#define JSON_CHUNK_SIZE 4096
+
+/* JSON escape sequences and the characters they stand for */
+static const char json_escapes[]   = "\"\\/bfnrt";
+static const char json_unescaped[] = "\"\\/\b\f\n\r\t";
+
+/**
+ * @brief State of the JSON tokenizer.
+ */
+typedef struct {
+	conf_data*	data;			  /**< Configuration data being loaded */
+	int			flags;			  /**< Flags passed to conf_load_ex() */
+	conf_error* err;			  /**< Diagnostics, may be NULL */
+	char*		buf;			  /**< Start of the buffer */
+	char*		pos;			  /**< Scan position in the buffer */
+	char*		end;			  /**< End of the NUL-terminated buffer */
+	char		key[MAX_KEY_LEN]; /**< Flattened path of the current value */
+	size_t		key_len;		  /**< Length of the path, may exceed key */
+	int			depth;			  /**< Nesting depth at the scan position */
+} json_parser;
+
+/**
+ * @brief Records a problem at a position of the document.
+ *
+ * Only the first problem is recorded, later ones are counted. The line and
+ * column are only computed for the first one.
+ *
+ * @return The error code.
+ */
+static conf_error_code json_error(json_parser* p, conf_error_code code,
+								  const char* pos, const char* reason)
+{
+	if (!p->err) return code;
+
+	if (p->err->code == CONF_OK) {
+		int			line  = 1;
+		const char* start = p->buf;
+		for (const char* c = p->buf; c < pos; c++) {
+			if (*c == '\n') {
+				line++;
+				start = c + 1;
+			}
+		}
+		p->err->code   = code;
+		p->err->line   = line;
+		p->err->column = (int)(pos - start) + 1;
+		p->err->reason = reason;
+		p->err->key	   = NULL;
+	}
+	p->err->problems++;
+	return code;
+}
+
+/**
+ * @brief Skips whitespace between tokens.
+ */
+static void json_skip(json_parser* p)
+{
+	while (*p->pos == ' ' || *p->pos == '\t' || *p->pos == '\n' ||
+		   *p->pos == '\r') {
+		p->pos++;
+	}
+}
+
+/**
+ * @brief Appends to the path of the current value.
+ *
+ * The length keeps counting beyond the buffer, so too long keys are detected
+ * once a value is added.
+ */
+static void json_append(json_parser* p, const char* str, size_t len)
+{
+	if (p->key_len < sizeof(p->key)) {
+		size_t room = sizeof(p->key) - p->key_len;
+		memcpy(p->key + p->key_len, str, len < room ? len : room);
+	}
+	p->key_len += len;
+}
+
+/**
+ * @brief Reads four hexadecimal digits.
+ *
+ * @return 0 on success, -1 if one of them is not a hexadecimal digit.
+ */
+static int json_hex4(const char* src, unsigned* code)
+{
+	*code = 0;
+	for (int i = 0; i < 4; i++) {
+		if (!isxdigit((unsigned char)src[i])) return -1;
+		char digit[2] = {src[i], '\0'};
+		*code		  = *code << 4 | (unsigned)strtoul(digit, NULL, 16);
+	}
+	return 0;
+}
+
+/**
+ * @brief Encodes a code point as UTF-8.
+ *
+ * @return Number of bytes written, at most 4.
+ */
+static size_t json_utf8(char* dst, unsigned code)
+{
+	if (code < 0x80) {
+		dst[0] = (char)code;
+		return 1;
+	}
+	if (code < 0x800) {
+		dst[0] = (char)(0xc0 | code >> 6);
+		dst[1] = (char)(0x80 | (code & 0x3f));
+		return 2;
+	}
+	if (code < 0x10000) {
+		dst[0] = (char)(0xe0 | code >> 12);
+		dst[1] = (char)(0x80 | (code >> 6 & 0x3f));
+		dst[2] = (char)(0x80 | (code & 0x3f));
+		return 3;
+	}
+	dst[0] = (char)(0xf0 | code >> 18);
+	dst[1] = (char)(0x80 | (code >> 12 & 0x3f));
+	dst[2] = (char)(0x80 | (code >> 6 & 0x3f));
+	dst[3] = (char)(0x80 | (code & 0x3f));
+	return 4;
+}
+
+/**
+ * @brief Parses a string in place.
+ *
+ * Escape sequences are decoded into the same memory, which never grows, since
+ * no sequence is shorter than its UTF-8 encoding. The string is terminated in
+ * place of the closing quote or earlier.
+ *
+ * @param[in]  p   Pointer to the parser, at the opening quote.
+ * @param[out] str Start of the decoded string.
+ * @param[out] len Length of the decoded string.
+ *
+ * @return CONF_OK on success, an error code otherwise.
+ */
+static conf_error_code json_string(json_parser* p, char** str, size_t* len)
+{
+	char* quote = p->pos;
+	char* src	= quote + 1;
+	char* dst	= src;
+	*str		= src;
+
+	while (*src != '"') {
+		if (src >= p->end) {
+			return json_error(p, CONF_ERR_QUOTE, quote, "unterminated string");
+		}
+		if ((unsigned char)*src < 0x20) {
+			return json_error(p, CONF_ERR_QUOTE, src,
+							  "control character in string");
+		}
+		if (*src != '\\') {
+			*dst++ = *src++;
+			continue;
+		}
+
+		// Simple escape sequences map to a single character
+		const char* esc = src[1] ? strchr(json_escapes, src[1]) : NULL;
+		if (esc) {
+			*dst++ = json_unescaped[esc - json_escapes];
+			src	  += 2;
+			continue;
+		}
+
+		// Unicode escape sequences, with surrogate pairs for supplementary
+		// characters
+		unsigned code, low;
+		char*	 seq = src;
+		if (src[1] != 'u' || json_hex4(src + 2, &code) != 0 || code == 0) {
+			return json_error(p, CONF_ERR_QUOTE, seq,
+							  "invalid escape sequence");
+		}
+		src += 6;
+		if (code >= 0xd800 && code < 0xdc00) {
+			if (src[0] != '\\' || src[1] != 'u' ||
+				json_hex4(src + 2, &low) != 0 || low < 0xdc00 ||
+				low >= 0xe000) {
+				return json_error(p, CONF_ERR_QUOTE, seq,
+								  "invalid surrogate pair");
+			}
+			code  = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+			src	 += 6;
+		} else if (code >= 0xdc00 && code < 0xe000) {
+			return json_error(p, CONF_ERR_QUOTE, seq,
+							  "invalid surrogate pair");
+		}
+		dst += json_utf8(dst, code);
+	}
+
+	*dst   = '\0';
+	*len   = dst - *str;
+	p->pos = src + 1;
+	return CONF_OK;
+}
+
+/**
+ * @brief Parses a number, typed as in Key=Value files.
+ *
+ * @return CONF_OK on success, an error code otherwise.
+ */
+static conf_error_code json_number(json_parser* p, conf_type* type,
+								   conf_value* value)
+{
+	char* start	  = p->pos;
+	char* c		  = start;
+	int	  integer = 1;
+
+	// Validate the syntax, which is stricter than that of strtod()
+	if (*c == '-') c++;
+	if (*c == '0') {
+		c++;
+	} else if (isdigit((unsigned char)*c)) {
+		while (isdigit((unsigned char)*c)) c++;
+	} else {
+		return json_error(p, CONF_ERR_SYNTAX, start, "invalid number");
+	}
+	if (*c == '.') {
+		integer = 0;
+		if (!isdigit((unsigned char)*++c)) {
+			return json_error(p, CONF_ERR_SYNTAX, start, "invalid number");
+		}
+		while (isdigit((unsigned char)*c)) c++;
+	}
+	if (*c == 'e' || *c == 'E') {
+		integer = 0;
+		c++;
+		if (*c == '+' || *c == '-') c++;
+		if (!isdigit((unsigned char)*c)) {
+			return json_error(p, CONF_ERR_SYNTAX, start, "invalid number");
+		}
+		while (isdigit((unsigned char)*c)) c++;
+	}
+	p->pos = c;
+
+	// Integers are read exactly, unless they do not fit into a long
+	if (integer) {
+		errno		= 0;
+		value->lval = strtol(start, NULL, 10);
+		*type		= CONF_LONG;
+		if (errno != ERANGE) return CONF_OK;
+	}
+
+	double dval = strtod(start, NULL);
+	if (dval >= (double)LONG_MIN && dval < (double)LONG_MAX &&
+		(double)(long)dval == dval) {
+		value->lval = (long)dval;
+		*type		= CONF_LONG;
+	} else {
+		value->dval = dval;
+		*type		= CONF_DOUBLE;
+	}
+	return CONF_OK;
+}
+
+/**
+ * @brief Consumes a literal if it is at the scan position.
+ *
+ * @return 1 if the literal was consumed, 0 otherwise.
+ */
+static int json_literal(json_parser* p, const char* word)
+{
+	size_t len = strlen(word);
+	if ((size_t)(p->end - p->pos) < len || memcmp(p->pos, word, len) != 0) {
+		return 0;
+	}
+	p->pos += len;
+	return 1;
+}
+
+static conf_error_code json_value(json_parser* p);
+
+/**
+ * @brief Parses an object, extending the path by the name of each member.
+ *
+ * @return CONF_OK on success or if all problems were skipped, an error code
+ * otherwise.
+ */
+static conf_error_code json_object(json_parser* p)
+{
+	size_t prefix = p->key_len;
+	p->pos++;
+	json_skip(p);
+	if (*p->pos == '}') {
+		p->pos++;
+		return CONF_OK;
+	}
+
+	for (;;) {
+		json_skip(p);
+		if (*p->pos != '"') {
+			return json_error(p, CONF_ERR_SYNTAX, p->pos,
+							  "expected member name");
+		}
+		char*			name;
+		size_t			len;
+		conf_error_code rc = json_string(p, &name, &len);
+		if (rc != CONF_OK) return rc;
+		json_skip(p);
+		if (*p->pos != ':') {
+			return json_error(p, CONF_ERR_SYNTAX, p->pos, "expected ':'");
+		}
+		p->pos++;
+
+		// Members of nested objects are separated by dots
+		p->key_len = prefix;
+		if (prefix > 0) json_append(p, ".", 1);
+		json_append(p, name, len);
+		rc = json_value(p);
+		if (rc != CONF_OK) return rc;
+
+		json_skip(p);
+		if (*p->pos == '}') break;
+		if (*p->pos != ',') {
+			return json_error(p, CONF_ERR_SYNTAX, p->pos,
+							  "expected ',' or '}'");
+		}
+		p->pos++;
+	}
+
+	p->pos++;
+	p->key_len = prefix;
+	return CONF_OK;
+}
+
+/**
+ * @brief Parses an array, extending the path by the index of each element.
+ *
+ * @return CONF_OK on success or if all problems were skipped, an error code
+ * otherwise.
+ */
+static conf_error_code json_array(json_parser* p)
+{
+	size_t prefix = p->key_len;
+	p->pos++;
+	json_skip(p);
+	if (*p->pos == ']') {
+		p->pos++;
+		return CONF_OK;
+	}
+
+	for (size_t i = 0;; i++) {
+		char index[24];
+		int	 len	= snprintf(index, sizeof(index), "[%zu]", i);
+		p->key_len	= prefix;
+		json_append(p, index, (size_t)len);
+		conf_error_code rc = json_value(p);
+		if (rc != CONF_OK) return rc;
+
+		json_skip(p);
+		if (*p->pos == ']') break;
+		if (*p->pos != ',') {
+			return json_error(p, CONF_ERR_SYNTAX, p->pos,
+							  "expected ',' or ']'");
+		}
+		p->pos++;
+	}
+
+	p->pos++;
+	p->key_len = prefix;
+	return CONF_OK;
+}
+
+/**
+ * @brief Parses a value and adds its scalars to the storage.
+ *
+ * @return CONF_OK on success or if all problems were skipped, an error code
+ * otherwise.
+ */
+static conf_error_code json_value(json_parser* p)
+{
+	json_skip(p);
+	char* start = p->pos;
+
+	// Containers recurse, with a bounded depth
+	if (*start == '{' || *start == '[') {
+		if (p->depth == JSON_MAX_DEPTH) {
+			return json_error(p, CONF_ERR_SYNTAX, start, "nesting too deep");
+		}
+		p->depth++;
+		conf_error_code rc =
+			*start == '{' ? json_object(p) : json_array(p);
+		p->depth--;
+		return rc;
+	}
+
+	conf_error_code rc		= CONF_OK;
+	conf_type		type	= CONF_LONG;
+	conf_value		value	= {0};
+	char*			str		= NULL;
+	const char*		literal = NULL;
+	size_t			len		= 0;
+	if (*start == '"') {
+		rc = json_string(p, &str, &len);
+	} else if (json_literal(p, "true")) {
+		literal = "true";
+	} else if (json_literal(p, "false")) {
+		literal = "false";
+	} else if (json_literal(p, "null")) {
+		return CONF_OK;
+	} else if (*start == '-' || isdigit((unsigned char)*start)) {
+		rc = json_number(p, &type, &value);
+	} else {
+		return json_error(p, CONF_ERR_SYNTAX, start, "unexpected character");
+	}
+	if (rc != CONF_OK) return rc;
+
+	// Values under keys that do not fit are skipped
+	if (p->key_len == 0 || p->key_len >= MAX_KEY_LEN) {
+		rc = json_error(p, CONF_ERR_KEY, start,
+						p->key_len ? "key too long" : "empty key");
+		return (p->flags & CONF_STRICT) ? rc : CONF_OK;
+	}
+
+	conf_store* store = p->data->store;
+	int			added;
+	if (str) {
+		added = conf_store_add_span(store, p->key, p->key_len, str, len);
+	} else if (literal) {
+		added = conf_store_add_string(store, p->key, p->key_len, literal,
+									  strlen(literal));
+	} else {
+		added = conf_store_add(store, p->key, p->key_len, type, value);
+	}
+	if (added != 0) return CONF_ERR_MEMORY;
+	p->data->count++;
+	return CONF_OK;
+}
+
+conf_error_code conf_json_parse(conf_data* data, char* buf, size_t size,
+								int flags, conf_error* err)
+{
+	json_parser p;
+	p.data	  = data;
+	p.flags	  = flags;
+	p.err	  = err;
+	p.buf	  = buf;
+	p.pos	  = buf;
+	p.end	  = buf + size;
+	p.key_len = 0;
+	p.depth	  = 0;
+
+	// Skip a byte order mark, which some editors write
+	if (size >= 3 && memcmp(buf, "\xef\xbb\xbf", 3) == 0) p.pos += 3;
+
+	json_skip(&p);
+	if (*p.pos != '{' && *p.pos != '[') {
+		return json_error(&p, CONF_ERR_SYNTAX, p.pos,
+						  "expected object or array");
+	}
+	conf_error_code rc = json_value(&p);
+	if (rc != CONF_OK) return rc;
+
+	json_skip(&p);
+	if (p.pos != p.end) {
+		return json_error(&p, CONF_ERR_SYNTAX, p.pos,
+						  "unexpected characters after document");
+	}
+	return CONF_OK;
+}
+
+/**
+ * @brief State of the JSON writer.
+ */
+typedef struct {
+	conf_write_cb write;				  /**< Callback taking the chunks */
+	void*		  ctx;					  /**< Context of the callback */
+	int			  first;				  /**< Whether no pair was written */
+	size_t		  len;					  /**< Bytes used in the chunk */
+	char		  chunk[JSON_CHUNK_SIZE]; /**< Output not passed on yet */
+} json_writer;
+
+/**
+ * @brief Passes the buffered output to the callback.
+ *
+ * @return 0 on success, -1 if the callback stopped writing.
+ */
+static int json_flush(json_writer* w)
+{
+	size_t len = w->len;
+	w->len	   = 0;
+	return len > 0 && w->write(w->chunk, len, w->ctx) != 0 ? -1 : 0;
+}
+
+/**
+ * @brief Appends bytes to the output, passing on full chunks.
+ *
+ * @return 0 on success, -1 if the callback stopped writing.
+ */
+static int json_put(json_writer* w, const char* str, size_t len)
+{
+	while (len > 0) {
+		if (w->len == sizeof(w->chunk) && json_flush(w) != 0) return -1;
+		size_t n = sizeof(w->chunk) - w->len;
+		if (n > len) n = len;
+		memcpy(w->chunk + w->len, str, n);
+		w->len += n;
+		str	   += n;
+		len	   -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Appends a quoted and escaped string to the output.
+ *
+ * Runs of characters that need no escaping are appended at once.
+ *
+ * @return 0 on success, -1 if the callback stopped writing.
+ */
+static int json_put_string(json_writer* w, const char* str)
+{
+	if (json_put(w, "\"", 1) != 0) return -1;
+
+	const char* run = str;
+	for (const char* c = str;; c++) {
+		unsigned char u = (unsigned char)*c;
+		if (u >= 0x20 && u != '"' && u != '\\') continue;
+		if (json_put(w, run, c - run) != 0) return -1;
+		if (u == '\0') break;
+
+		// Use the short escape sequences where there is one
+		char		esc[8];
+		int			len = 2;
+		const char* pos = strchr(json_unescaped, u);
+		if (pos) {
+			esc[0] = '\\';
+			esc[1] = json_escapes[pos - json_unescaped];
+		} else {
+			len = snprintf(esc, sizeof(esc), "\\u%04x", u);
+		}
+		if (json_put(w, esc, (size_t)len) != 0) return -1;
+		run = c + 1;
+	}
+
+	return json_put(w, "\"", 1);
+}
+
+/**
+ * @brief Formats a floating point number with the fewest digits that read
+ * back as the same value.
+ *
+ * @return Length of the formatted number.
+ */
+static int json_format_double(char* buf, size_t size, double value,
+							  int max_digits)
+{
+	if (!isfinite(value)) return snprintf(buf, size, "null");
+
+	int len = 0;
+	for (int digits = max_digits - 2; digits <= max_digits; digits++) {
+		len = snprintf(buf, size, "%.*g", digits, value);
+		if (strtod(buf, NULL) == value) break;
+	}
+	return len;
+}
+
+/**
+ * @brief Appends a pair as a member of the output object.
+ *
+ * @return 0 on success, -1 if the callback stopped writing.
+ */
+static int json_put_pair(const char* key, conf_type type, conf_value value,
+						 void* ctx)
+{
+	json_writer* w = (json_writer*)ctx;
+	if (json_put(w, w->first ? "{" : ",", 1) != 0 ||
+		json_put_string(w, key) != 0 || json_put(w, ":", 1) != 0) {
+		return -1;
+	}
+	w->first = 0;
+
+	char num[32];
+	int	 len = 0;
+	switch (type) {
+	case CONF_INT:
+		len = snprintf(num, sizeof(num), "%d", value.ival);
+		break;
+	case CONF_LONG:
+		len = snprintf(num, sizeof(num), "%ld", value.lval);
+		break;
+	case CONF_FLOAT:
+		len = json_format_double(num, sizeof(num), value.fval, 9);
+		break;
+	case CONF_DOUBLE:
+		len = json_format_double(num, sizeof(num), value.dval, 17);
+		break;
+	case CONF_CHAR: {
+		char str[2] = {value.cval, '\0'};
+		return json_put_string(w, str);
+	}
+	case CONF_STRING:
+		return json_put_string(w, value.str);
+	}
+	return json_put(w, num, (size_t)len);
+}
+
+int conf_write_json(const conf_data* data, conf_write_cb write, void* ctx)
+{
+	if (!data || !write) return -1;
+
+	json_writer w;
+	w.write = write;
+	w.ctx	= ctx;
+	w.first = 1;
+	w.len	= 0;
+	if (conf_pairs_walk(data, json_put_pair, &w) != 0 ||
+		json_put(&w, w.first ? "{}" : "}", w.first ? 2 : 1) != 0) {
+		return -1;
+	}
+	return json_flush(&w);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file conf_load.h
+ * @brief Internal loading entry points of the libconf library.
+ *
+ * Every loader of a file goes through conf_load_file(), which maps the parse
+ * cache, or else parses the contents with conf_load_buffer(), and then replays
+ * the override journal with conf_journal_replay(). Loaders that read files by
+ * their own means, such as the batch loader, hand it the contents they read.
+ * Loaders of already parsed data, such as the parse cache, map store images
+ * with conf_load_image().
+ */
+
+#ifndef CONF_LOAD_H
+#define CONF_LOAD_H
+
+#include "libconf.h"
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * Internal load flag that records the source line of each pair in the store,
+ * see conf_store_line(). Only line-based dialects record lines, and files
+ * loaded with it bypass the parse cache, whose images do not keep them.
+ */
+#define CONF_LINES (1 << 16)
+
+/**
+ * @brief Loads a configuration file, from its parse cache if it is valid.
+ *
+ * A cache miss parses @p buf, or the file read here if @p buf is NULL, and
+ * saves the result to the cache. The override journal is replayed on top.
+ *
+ * @param[in]  filename Name of the configuration file.
+ * @param[in]  buf      Contents of the file as for conf_load_buffer(), which
+ *                      are freed in any case, or NULL to read the file.
+ * @param[in]  size     Number of bytes in @p buf.
+ * @param[in]  st       Status of the file before @p buf was read, or NULL if
+ *                      unknown, in which case the result is not cached.
+ * @param[in]  flags    Bitwise OR of conf_load_flags values.
+ * @param[out] err      Pointer to the conf_error struct to fill in, may be
+ *                      NULL.
+ *
+ * @return Pointer to the conf_data struct on success, NULL on failure.
+ */
+conf_data* conf_load_file(const char* filename, char* buf, size_t size,
+						  const struct stat* st, int flags, conf_error* err);
+
+/**
+ * @brief Parses a buffer holding the contents of a configuration file.
+ *
+ * The buffer is parsed in place and owned by the returned data, which frees
+ * it once no value refers to it. On failure the buffer is freed.
+ *
+ * @param[in]  buf   Buffer allocated with malloc(), holding @p size bytes
+ *                   followed by a NUL byte.
+ * @param[in]  size  Number of bytes in the buffer, not counting the NUL byte.
+ * @param[in]  flags Bitwise OR of conf_load_flags values.
+ * @param[out] err   Pointer to the conf_error struct to fill in, may be NULL.
+ *
+ * @return Pointer to the conf_data struct on success, NULL on failure.
+ */
+conf_data* conf_load_buffer(char* buf, size_t size, int flags,
+							conf_error* err);
+
+/**
+ * @brief Parses a JSON document into the store of configuration data.
+ *
+ * Called by conf_load_buffer() for CONF_JSON. Scalars are added to the store
+ * of @p data under their flattened keys, and counted in its @p count member.
+ *
+ * @param[in]  data  Pointer to the conf_data struct whose store is filled.
+ * @param[in]  buf   Buffer owned by the store, holding @p size bytes followed
+ *                   by a NUL byte, which is parsed in place.
+ * @param[in]  size  Number of bytes in the buffer, not counting the NUL byte.
+ * @param[in]  flags Bitwise OR of conf_load_flags values.
+ * @param[out] err   Pointer to the conf_error struct to fill in, may be NULL.
+ *
+ * @return CONF_OK on success or if all problems were skipped, an error code
+ * otherwise. CONF_ERR_MEMORY is not recorded in @p err.
+ */
+conf_error_code conf_json_parse(conf_data* data, char* buf, size_t size,
+								int flags, conf_error* err);
+
+/**
+ * @brief Creates configuration data over a private mapping of a store image.
+ *
+ * @param[in] image  Start of the mapping, aligned to a page.
+ * @param[in] size   Size of the mapping.
+ * @param[in] offset Offset of the image saved by conf_store_save().
+ *
+ * @return Pointer to the conf_data struct, which owns the mapping, or NULL if
+ * the image is invalid or on allocation failure, in which case the mapping is
+ * left to the caller.
+ */
+conf_data* conf_load_image(void* image, size_t size, size_t offset);
+
+/**
+ * @brief Replays the override journal of a configuration file.
+ *
+ * Applies the valid records of the journal to the data in order, replacing
+ * @p data by each new version. A partial or corrupt record ends the replay.
+ *
+ * @param[in]     filename Name of the configuration file.
+ * @param[in,out] data     Data loaded from the file.
+ *
+ * @return 0 on success or if there is no journal, -1 on failure with errno
+ * set, in which case @p data holds the last successfully applied version.
+ */
+int conf_journal_replay(const char* filename, conf_data** data);
+
+#endif /* CONF_LOAD_H */
@@ -0,0 +1,67 @@
+/**
+ * @file conf_notify.c
+ * @brief Notification descriptors of the libconf library.
+ */
+
+#include "conf_notify.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+int conf_notify_open(conf_notify* notify)
+{
+#ifdef __linux__
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0) return -1;
+	notify->read_fd	 = fd;
+	notify->write_fd = fd;
+#else
+	int fds[2];
+	if (pipe(fds) != 0) return -1;
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	notify->read_fd	 = fds[0];
+	notify->write_fd = fds[1];
+#endif
+	return 0;
+}
+
+void conf_notify_close(conf_notify* notify)
+{
+	if (notify->read_fd < 0) return;
+	close(notify->read_fd);
+	if (notify->write_fd != notify->read_fd) close(notify->write_fd);
+	notify->read_fd	 = -1;
+	notify->write_fd = -1;
+}
+
+void conf_notify_signal(const conf_notify* notify)
+{
+	if (notify->write_fd < 0) return;
+
+	/* A full pipe is readable already, so failed writes are not retried */
+	uint64_t one = 1;
+	ssize_t	 rc;
+	do {
+		rc = write(notify->write_fd, &one, sizeof(one));
+	} while (rc < 0 && errno == EINTR);
+}
+
+void conf_notify_drain(const conf_notify* notify)
+{
+	if (notify->read_fd < 0) return;
+
+	uint64_t buf[8];
+	for (;;) {
+		ssize_t rc = read(notify->read_fd, buf, sizeof(buf));
+		if (rc <= 0 && !(rc < 0 && errno == EINTR)) break;
+	}
+}
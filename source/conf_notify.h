@@ -0,0 +1,54 @@
+/**
+ * @file conf_notify.h
+ * @brief Internal notification descriptors of the libconf library.
+ *
+ * A notification descriptor becomes readable when it is signalled and stays
+ * readable until it is drained, so event loops can wait on it with epoll, poll
+ * or io_uring. On Linux it is an eventfd, elsewhere a non-blocking pipe.
+ */
+
+#ifndef CONF_NOTIFY_H
+#define CONF_NOTIFY_H
+
+/**
+ * @brief Notification descriptor pair.
+ */
+typedef struct {
+	int read_fd;  /**< Descriptor to wait on, -1 if not open */
+	int write_fd; /**< Descriptor to signal, same as read_fd for an eventfd */
+} conf_notify;
+
+/** Initializer of a notification that is not open */
+#define CONF_NOTIFY_INIT {-1, -1}
+
+/**
+ * @brief Opens a notification descriptor.
+ *
+ * @param[out] notify Pointer to the notification to open.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int conf_notify_open(conf_notify* notify);
+
+/**
+ * @brief Closes a notification descriptor, if open.
+ *
+ * @param[in] notify Pointer to the notification to close.
+ */
+void conf_notify_close(conf_notify* notify);
+
+/**
+ * @brief Makes a notification descriptor readable, if open.
+ *
+ * @param[in] notify Pointer to the notification.
+ */
+void conf_notify_signal(const conf_notify* notify);
+
+/**
+ * @brief Drains a notification descriptor, so it is no longer readable.
+ *
+ * @param[in] notify Pointer to the notification.
+ */
+void conf_notify_drain(const conf_notify* notify);
+
+#endif /* CONF_NOTIFY_H */
@@ -0,0 +1,41 @@
+/**
+ * @file conf_proto.h
+ * @brief Internal protocol between libconfd and its clients.
+ *
+ * Clients connect to the Unix domain socket of the daemon with a sequenced
+ * packet socket and send one message holding the NUL-terminated name of a
+ * configuration file. The daemon answers with a reply: on success, the status
+ * is CONF_OK and the descriptor of a sealed memfd holding the snapshot is
+ * attached; otherwise the status is the error code of the load and nothing is
+ * attached. Every later snapshot of the file is pushed as another reply.
+ */
+
+#ifndef CONF_PROTO_H
+#define CONF_PROTO_H
+
+#include "libconf.h"
+
+/**
+ * @brief Sends a reply.
+ *
+ * @param[in] sock   Connected socket.
+ * @param[in] status CONF_OK or the error code of the load.
+ * @param[in] fd     Descriptor to attach if @p status is CONF_OK.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int conf_proto_send(int sock, conf_error_code status, int fd);
+
+/**
+ * @brief Receives a reply.
+ *
+ * @param[in]  sock   Connected socket.
+ * @param[out] status Status of the reply.
+ * @param[out] fd     Attached descriptor, or -1.
+ *
+ * @return 1 if a reply was received, 0 if none is pending on a non-blocking
+ * socket, -1 on failure or if the peer closed the connection.
+ */
+int conf_proto_recv(int sock, conf_error_code* status, int* fd);
+
+#endif /* CONF_PROTO_H */
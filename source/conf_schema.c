@@ -0,0 +1,418 @@
+/**
+ * @file conf_schema.c
+ * @brief Schema validation for the libconf library.
+ *
+ * A schema is itself a configuration file that maps each key to a rule, e.g.
+ * 'port = int required 1..65535'. Compiling a schema turns the rules into a
+ * table that stores each key together with its hash, as computed for the index
+ * of the configuration data. Validation walks the table once and probes the
+ * index with the precomputed hashes, so no key is hashed again.
+ */
+
+#include "conf_load.h"
+#include "conf_store.h"
+#include "conf_trie.h"
+#include "libconf.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum length of a single token of a rule */
+#define MAX_TOKEN_LEN 64
+
+/* Flags of a compiled rule */
+#define RULE_REQUIRED 0x1
+#define RULE_MIN	  0x2
+#define RULE_MAX	  0x4
+
+/**
+ * @brief Enumeration of the types a rule can require.
+ */
+typedef enum {
+	RULE_ANY,	 /**< Any type */
+	RULE_INT,	 /**< Integer that fits into an int */
+	RULE_LONG,	 /**< Integer */
+	RULE_DOUBLE, /**< Integer or floating-point number */
+	RULE_STRING, /**< String */
+	RULE_CHAR,	 /**< String of a single character */
+} rule_type;
+
+/**
+ * @brief Compiled rule for a single key.
+ */
+typedef struct {
+	uint64_t	hash;		  /**< Hash of the key, as used by the index */
+	const char* key;		  /**< Key, owned by the schema file data */
+	rule_type	type;		  /**< Required type of the value */
+	unsigned	flags;		  /**< Bitwise OR of the RULE_* flags */
+	double		min;		  /**< Minimum value, or minimum string length */
+	double		max;		  /**< Maximum value, or maximum string length */
+	char*		enums;		  /**< Allowed values separated by NULs, or NULL */
+	double*		enum_numbers; /**< Allowed values as numbers, NaN if not */
+} conf_rule;
+
+/**
+ * @brief Compiled schema.
+ */
+struct conf_schema {
+	conf_rule* rules;  /**< Rules in the order of the schema file */
+	int		   count;  /**< Number of rules */
+	conf_data* source; /**< Schema file data, owns the keys of the rules */
+};
+
+/* Names of the rule types, indexed by rule_type */
+static const char* const type_names[] = {"any",	   "int",	 "long",
+										 "double", "string", "char"};
+
+/**
+ * @brief Fills in the first problem and counts all problems.
+ */
+static void report(conf_error* err, conf_error_code code, const char* key,
+				   const char* reason)
+{
+	if (!err) return;
+	if (err->code == CONF_OK) {
+		err->code	= code;
+		err->key	= key;
+		err->reason = reason;
+	}
+	err->problems++;
+}
+
+/**
+ * @brief Resets the error info, if requested.
+ */
+static void reset(conf_error* err)
+{
+	if (!err) return;
+	memset(err, 0, sizeof(*err));
+}
+
+/**
+ * @brief Parses a range token of the form 'min..max'.
+ *
+ * Either bound may be omitted. Returns 0 on success, -1 if the token is not a
+ * range.
+ */
+static int parse_range(conf_rule* rule, char* token)
+{
+	char* dots = strstr(token, "..");
+	if (!dots) return -1;
+
+	/* Terminate the minimum, so strtod() does not take the dot as a fraction */
+	char* end;
+	*dots = '\0';
+	if (dots > token) {
+		rule->min = strtod(token, &end);
+		if (end != dots) return -1;
+		rule->flags |= RULE_MIN;
+	}
+	if (dots[2]) {
+		rule->max = strtod(dots + 2, &end);
+		if (*end) return -1;
+		rule->flags |= RULE_MAX;
+	}
+	return 0;
+}
+
+/**
+ * @brief Stores the allowed values of a token of the form 'a|b|c'.
+ *
+ * Values are also parsed as numbers the way the loader parses them, so numbers
+ * compare by value rather than by their spelling.
+ */
+static int parse_enums(conf_rule* rule, const char* token)
+{
+	size_t len	 = strlen(token);
+	size_t count = 1;
+	char*  list	 = (char*)malloc(len + 2);
+	if (!list) return -1;
+
+	/* Separate the values by NULs and end the list with an empty value */
+	for (size_t i = 0; i <= len; i++) {
+		list[i] = token[i] == '|' ? '\0' : token[i];
+		count  += token[i] == '|';
+	}
+	list[len + 1] = '\0';
+
+	double* numbers = (double*)malloc(count * sizeof(double));
+	if (!numbers) {
+		free(list);
+		return -1;
+	}
+	size_t n = 0;
+	for (const char* e = list; n < count; e += strlen(e) + 1) {
+		char* end;
+		numbers[n++] = *e ? strtod(e, &end) : NAN;
+		if (*e && *end) numbers[n - 1] = NAN;
+	}
+
+	free(rule->enums);
+	free(rule->enum_numbers);
+	rule->enums		   = list;
+	rule->enum_numbers = numbers;
+	return 0;
+}
+
+/**
+ * @brief Compiles the rule text of a key.
+ *
+ * @return CONF_OK on success, an error code otherwise.
+ */
+static conf_error_code compile_rule(conf_rule* rule, const char* text,
+									const char** reason)
+{
+	char		token[MAX_TOKEN_LEN];
+	int			expect_enums = 0;
+	int			tokens		 = 0;
+	const char* pos			 = text;
+
+	while (*(pos += strspn(pos, " \t"))) {
+		size_t len = strcspn(pos, " \t");
+		if (len >= sizeof(token)) {
+			*reason = "rule token too long";
+			return CONF_ERR_SCHEMA;
+		}
+		memcpy(token, pos, len);
+		token[len] = '\0';
+		pos		  += len;
+
+		/* The first token is the type */
+		if (tokens++ == 0) {
+			size_t t = 0;
+			while (t < sizeof(type_names) / sizeof(type_names[0]) &&
+				   strcmp(token, type_names[t]) != 0) {
+				t++;
+			}
+			if (t == sizeof(type_names) / sizeof(type_names[0])) {
+				*reason = "unknown type";
+				return CONF_ERR_SCHEMA;
+			}
+			rule->type = (rule_type)t;
+		} else if (expect_enums) {
+			if (parse_enums(rule, token) != 0) return CONF_ERR_MEMORY;
+			expect_enums = 0;
+		} else if (strcmp(token, "required") == 0) {
+			rule->flags |= RULE_REQUIRED;
+		} else if (strcmp(token, "enum") == 0) {
+			expect_enums = 1;
+		} else if (parse_range(rule, token) != 0) {
+			*reason = "unknown rule token";
+			return CONF_ERR_SCHEMA;
+		}
+	}
+
+	if (tokens == 0) {
+		*reason = "missing type";
+		return CONF_ERR_SCHEMA;
+	}
+	if (expect_enums) {
+		*reason = "missing allowed values";
+		return CONF_ERR_SCHEMA;
+	}
+	return CONF_OK;
+}
+
+/**
+ * @brief Reports a malformed rule with its key and line.
+ *
+ * The key is freed with the schema, so it is copied into a buffer of the
+ * calling thread that stays valid until its next failed compile.
+ */
+static void report_rule(conf_error* err, conf_error_code code,
+						const conf_store* store, int i, const char* reason)
+{
+	static _Thread_local char key[MAX_KEY_LEN];
+
+	reset(err);
+	if (!err) return;
+	snprintf(key, sizeof(key), "%s", conf_store_key(store, i));
+	report(err, code, key, reason);
+	err->line = conf_store_line(store, i);
+}
+
+conf_schema* conf_schema_compile(const char* filename, conf_error* err)
+{
+	conf_data* source = conf_load_file(filename, NULL, 0, NULL,
+									   CONF_STRICT | CONF_LINES, err);
+	if (!source) return NULL;
+
+	conf_schema* schema = (conf_schema*)calloc(1, sizeof(conf_schema));
+	if (!schema) {
+		conf_free(source);
+		reset(err);
+		report(err, CONF_ERR_MEMORY, NULL, "Failed to allocate memory");
+		return NULL;
+	}
+	schema->source = source;
+
+	/* Allocate one spare rule, so empty schemas need no special case */
+	schema->rules = (conf_rule*)calloc(source->count + 1, sizeof(conf_rule));
+	if (!schema->rules) {
+		conf_schema_free(schema);
+		reset(err);
+		report(err, CONF_ERR_MEMORY, NULL, "Failed to allocate memory");
+		return NULL;
+	}
+
+	/* Compile the rule of every key in the order of the schema file */
+	const conf_store* store = source->store;
+	for (int i = 0; i < store->count; i++) {
+		conf_rule*		rule   = &schema->rules[schema->count++];
+		const char*		reason = "rule is not a string";
+		conf_error_code code   = CONF_ERR_SCHEMA;
+
+		rule->key  = conf_store_key(store, i);
+		rule->hash = conf_hash(rule->key, NULL);
+
+		/* Only the first rule of a key would ever be found */
+		if (conf_store_find_hash(store, rule->key, rule->hash) != i) {
+			report_rule(err, CONF_ERR_SCHEMA, store, i, "duplicate rule");
+			conf_schema_free(schema);
+			return NULL;
+		}
+
+		if (conf_store_type(store, i) == CONF_STRING) {
+			code = compile_rule(rule, conf_store_string(store, i), &reason);
+		}
+		if (code != CONF_OK) {
+			report_rule(err, code, store, i,
+						code == CONF_ERR_MEMORY ? "Failed to allocate memory"
+												: reason);
+			conf_schema_free(schema);
+			return NULL;
+		}
+	}
+
+	return schema;
+}
+
+void conf_schema_free(conf_schema* schema)
+{
+	if (!schema) return;
+
+	for (int i = 0; i < schema->count; i++) {
+		free(schema->rules[i].enums);
+		free(schema->rules[i].enum_numbers);
+	}
+	free(schema->rules);
+	conf_free(schema->source);
+	free(schema);
+}
+
+/**
+ * @brief Checks whether a value is one of the allowed values of a rule.
+ *
+ * Strings and characters compare with the allowed values as written, numbers
+ * with the allowed values that parse as numbers.
+ */
+static int is_allowed(const conf_rule* rule, conf_type type, conf_value value)
+{
+	size_t n = 0;
+	for (const char* e = rule->enums; *e; e += strlen(e) + 1, n++) {
+		switch (type) {
+		case CONF_STRING:
+			if (strcmp(e, value.str) == 0) return 1;
+			break;
+		case CONF_CHAR:
+			if (e[0] == value.cval && e[1] == '\0') return 1;
+			break;
+		case CONF_LONG:
+			if (rule->enum_numbers[n] == (double)value.lval &&
+				(long long)rule->enum_numbers[n] == value.lval) {
+				return 1;
+			}
+			break;
+		case CONF_DOUBLE:
+			if (rule->enum_numbers[n] == value.dval) return 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+int conf_validate(const conf_data* data, const conf_schema* schema,
+				  conf_error* err)
+{
+	reset(err);
+	if (!data || !data->store || !schema) {
+		report(err, CONF_ERR_SCHEMA, NULL, "missing data or schema");
+		return -1;
+	}
+
+	int problems = 0;
+	for (int r = 0; r < schema->count; r++) {
+		const conf_rule* rule = &schema->rules[r];
+
+		/* Probe the index with the precomputed hash of the key */
+		conf_type  type;
+		conf_value value;
+		if (conf_lookup(data, rule->key, rule->hash, &type, &value) != 0) {
+			if (rule->flags & RULE_REQUIRED) {
+				report(err, CONF_ERR_MISSING, rule->key,
+					   "required key is missing");
+				problems++;
+			}
+			continue;
+		}
+
+		/* Check the type, and get the number the range applies to */
+		const char* str		= type == CONF_STRING ? value.str : NULL;
+		double		number	= 0;
+		int			numeric = 1;
+		int			typed	= 1;
+		switch (type) {
+		case CONF_LONG:
+			number = (double)value.lval;
+			typed  = rule->type == RULE_ANY || rule->type == RULE_LONG ||
+					rule->type == RULE_DOUBLE ||
+					(rule->type == RULE_INT &&
+					 value.lval >= INT_MIN &&
+					 value.lval <= INT_MAX);
+			break;
+		case CONF_DOUBLE:
+			number = value.dval;
+			typed  = rule->type == RULE_ANY || rule->type == RULE_DOUBLE;
+			break;
+		case CONF_STRING:
+			number = (double)strlen(str);
+			typed  = rule->type == RULE_ANY || rule->type == RULE_STRING ||
+					(rule->type == RULE_CHAR && number == 1);
+			break;
+		case CONF_CHAR:
+			numeric = 0;
+			typed	= rule->type == RULE_ANY || rule->type == RULE_CHAR;
+			break;
+		default:
+			numeric = 0;
+			typed	= rule->type == RULE_ANY;
+			break;
+		}
+		if (!typed) {
+			report(err, CONF_ERR_TYPE, rule->key, "value has the wrong type");
+			problems++;
+			continue;
+		}
+
+		/* Ranges apply to numbers and to the length of strings */
+		if (numeric && (((rule->flags & RULE_MIN) && number < rule->min) ||
+						((rule->flags & RULE_MAX) && number > rule->max))) {
+			report(err, CONF_ERR_RANGE, rule->key, "value is out of range");
+			problems++;
+			continue;
+		}
+
+		if (rule->enums && !is_allowed(rule, type, value)) {
+			report(err, CONF_ERR_ENUM, rule->key,
+				   "value is not one of the allowed values");
+			problems++;
+		}
+	}
+
+	return problems ? -1 : 0;
+}
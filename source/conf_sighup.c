@@ -0,0 +1,199 @@
+/**
+ * @file conf_sighup.c
+ * @brief Reloading configuration handles on SIGHUP for the libconf library.
+ *
+ * A driver thread owned by the library waits for SIGHUP and reloads every
+ * watched handle, so no parsing happens in signal context. On Linux, SIGHUP is
+ * blocked and read from a signalfd. Elsewhere, or if no signalfd can be
+ * created, a signal handler writes to a self-pipe instead. Signals that arrive
+ * while the driver is busy are coalesced into a single reload. Once started,
+ * the driver runs until the process exits, idle while no handle is watched.
+ */
+
+#include "libconf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
+
+/**
+ * @brief State of the SIGHUP driver, shared by all handles.
+ */
+static struct {
+	pthread_mutex_t lock;	   /**< Protects all other members */
+	conf_handle**	handles;   /**< Watched handles */
+	int				count;	   /**< Number of watched handles */
+	int				cap;	   /**< Capacity of the handle array */
+	int				running;   /**< Whether the driver thread runs */
+	int				signal_fd; /**< Readable once SIGHUP arrived */
+} driver = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, -1};
+
+/* Write end of the self-pipe, read by the signal handler */
+static volatile sig_atomic_t self_pipe = -1;
+
+/**
+ * @brief Writes to the self-pipe, a full pipe already wakes the driver.
+ */
+static void on_sighup(int signo)
+{
+	(void)signo; /* unused */
+
+	int	 saved = errno;
+	char byte  = 0;
+	if (write(self_pipe, &byte, 1) < 0) {
+		/* Nothing to do in signal context */
+	}
+	errno = saved;
+}
+
+/**
+ * @brief Reads all pending signals, so repeated signals cause one reload.
+ */
+static void drain_signals(void)
+{
+	char buf[256];
+	for (;;) {
+		ssize_t rc = read(driver.signal_fd, buf, sizeof(buf));
+		if (rc <= 0 && !(rc < 0 && errno == EINTR)) break;
+	}
+}
+
+/**
+ * @brief Reloads the watched handles whenever SIGHUP arrives.
+ */
+static void* driver_main(void* arg)
+{
+	(void)arg; /* unused */
+
+	struct pollfd fds = {driver.signal_fd, POLLIN, 0};
+	for (;;) {
+		if (poll(&fds, 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		drain_signals();
+		pthread_mutex_lock(&driver.lock);
+		for (int i = 0; i < driver.count; i++) {
+			conf_handle_reload(driver.handles[i], NULL);
+		}
+		pthread_mutex_unlock(&driver.lock);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Sets up a self-pipe written by a SIGHUP handler.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int open_self_pipe(void)
+{
+	int fds[2];
+	if (pipe(fds) != 0) return -1;
+	for (int i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+	self_pipe = fds[1];
+
+	struct sigaction action;
+	action.sa_handler = on_sighup;
+	action.sa_flags	  = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGHUP, &action, NULL) != 0) {
+		close(fds[0]);
+		close(fds[1]);
+		self_pipe = -1;
+		return -1;
+	}
+
+	driver.signal_fd = fds[0];
+	return 0;
+}
+
+/**
+ * @brief Starts the driver thread. Must hold the lock.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int start_driver(void)
+{
+	if (driver.signal_fd < 0) {
+#ifdef __linux__
+		/* A signalfd only receives signals that are blocked */
+		sigset_t hup;
+		sigemptyset(&hup);
+		sigaddset(&hup, SIGHUP);
+		pthread_sigmask(SIG_BLOCK, &hup, NULL);
+		driver.signal_fd = signalfd(-1, &hup, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (driver.signal_fd < 0) pthread_sigmask(SIG_UNBLOCK, &hup, NULL);
+#endif
+		if (driver.signal_fd < 0 && open_self_pipe() != 0) return -1;
+	}
+
+	/* The driver thread never runs the handler, so reloads never interrupt */
+	pthread_attr_t attr;
+	pthread_t	   thread;
+	sigset_t	   all;
+	sigset_t	   old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int rc = pthread_attr_init(&attr);
+	if (rc == 0) {
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		rc = pthread_create(&thread, &attr, driver_main, NULL);
+		pthread_attr_destroy(&attr);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	/* Keep the descriptor, a later attempt may still start the thread */
+	if (rc != 0) return -1;
+
+	driver.running = 1;
+	return 0;
+}
+
+int conf_handle_watch_sighup(conf_handle* handle)
+{
+	if (!handle) return -1;
+
+	pthread_mutex_lock(&driver.lock);
+	int rc = 0;
+	if (driver.count == driver.cap) {
+		int			  cap	  = driver.cap ? driver.cap * 2 : 4;
+		conf_handle** handles = (conf_handle**)realloc(
+			driver.handles, (size_t)cap * sizeof(*handles));
+		if (handles) {
+			driver.handles = handles;
+			driver.cap	   = cap;
+		} else {
+			rc = -1;
+		}
+	}
+	if (rc == 0 && !driver.running) rc = start_driver();
+	if (rc == 0) driver.handles[driver.count++] = handle;
+	pthread_mutex_unlock(&driver.lock);
+	return rc;
+}
+
+void conf_handle_unwatch_sighup(conf_handle* handle)
+{
+	/* Reloads hold the lock, so none is running once this returns */
+	pthread_mutex_lock(&driver.lock);
+	for (int i = 0; i < driver.count; i++) {
+		if (driver.handles[i] == handle) {
+			driver.handles[i] = driver.handles[--driver.count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&driver.lock);
+}
@@ -0,0 +1,819 @@
+/**
+ * @file conf_store.c
+ * @brief Structure-of-arrays pair storage for the libconf library.
+ *
+ * Keys are appended to a single arena and referenced by offset, so the pair
+ * arrays stay small and dense. The index maps keys to pairs with open
+ * addressing over groups of 16 slots. The top 7 bits of the key hash are kept
+ * as a tag in the control byte of each slot; a probe compares all 16 tags of a
+ * group at once (using SSE2 where available), then the 32-bit hash of each
+ * candidate, and only then the key string.
+ *
+ * The Bloom filter in front of the index is split into 512-bit blocks. The
+ * upper half of the key hash selects a block, and FILTER_PROBES bit positions
+ * within the block are taken from a remix of the hash.
+ */
+
+#include "conf_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Initial number of pairs and key bytes allocated for a new store */
+#define STORE_INIT_PAIRS 16
+#define STORE_INIT_KEYS	 512
+
+/* Number of index slots probed at once, and control byte of an empty slot */
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY	0x80
+
+/* Tag of a key hash stored in the control byte of its slot */
+#define HASH_TAG(h) ((unsigned char)((h) >> 57))
+
+/* Default size of a string pool chunk, and initial size of the intern table */
+#define POOL_CHUNK_SIZE	 4096
+#define INTERN_INIT_SIZE 64
+
+/* Bloom filter sizing: bits per key, bits set per key, and words per block */
+#define FILTER_BITS_PER_KEY 12
+#define FILTER_PROBES		6
+#define FILTER_BLOCK_WORDS	8
+
+/* FNV-1a parameters used by the hash functions */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+/**
+ * @brief Finalizes an FNV-1a hash to spread its low bits.
+ */
+static inline uint64_t hash_finish(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t conf_hash(const char* key, size_t* len)
+{
+	uint64_t	h = FNV_OFFSET;
+	const char* p = key;
+	while (*p) {
+		h ^= (unsigned char)*p++;
+		h *= FNV_PRIME;
+	}
+	if (len) *len = p - key;
+	return hash_finish(h);
+}
+
+uint64_t conf_hash_bytes(const char* str, size_t len)
+{
+	uint64_t h = FNV_OFFSET;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)str[i];
+		h *= FNV_PRIME;
+	}
+	return hash_finish(h);
+}
+
+conf_store* conf_store_new(void)
+{
+	conf_store* store = (conf_store*)calloc(1, sizeof(conf_store));
+	if (store) store->refs = 1;
+	return store;
+}
+
+void conf_store_free(conf_store* store)
+{
+	if (!store) return;
+
+	/* The arrays of a store mapped from an image live in the mapping */
+	if (store->image) {
+		munmap(store->image, store->image_size);
+		free(store);
+		return;
+	}
+
+	/* Free the chunks of the string pool */
+	while (store->pool) {
+		conf_chunk* next = store->pool->next;
+		free(store->pool);
+		store->pool = next;
+	}
+
+	free(store->hashes);
+	free(store->key_offs);
+	free(store->types);
+	free(store->values);
+	free(store->keys);
+	free(store->ctrl);
+	free(store->slots);
+	free(store->filter);
+	free(store->intern);
+	free(store->source);
+	free(store->lines);
+	free(store);
+}
+
+/**
+ * @brief Returns the filter block of a key hash.
+ */
+static inline uint64_t* filter_block(const conf_store* store, uint64_t hash)
+{
+	uint64_t block = ((hash >> 32) * store->filter_blocks) >> 32;
+	return store->filter + block * FILTER_BLOCK_WORDS;
+}
+
+/**
+ * @brief Sets the filter bits of a key hash.
+ */
+static void filter_add(conf_store* store, uint64_t hash)
+{
+	uint64_t* block = filter_block(store, hash);
+	uint64_t  bits	= hash * 0x9e3779b97f4a7c15ULL;
+	for (int k = 0; k < FILTER_PROBES; k++, bits >>= 9) {
+		block[(bits & 511) >> 6] |= 1ULL << (bits & 63);
+	}
+}
+
+int conf_store_filter_test(const conf_store* store, uint64_t hash)
+{
+	if (!store->filter) return 1;
+
+	const uint64_t* block = filter_block(store, hash);
+	uint64_t		bits  = hash * 0x9e3779b97f4a7c15ULL;
+	for (int k = 0; k < FILTER_PROBES; k++, bits >>= 9) {
+		if (!(block[(bits & 511) >> 6] & (1ULL << (bits & 63)))) return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Builds the Bloom filter over the indexed keys.
+ */
+static int store_build_filter(conf_store* store)
+{
+	size_t	 bits	= (size_t)store->indexed * FILTER_BITS_PER_KEY;
+	uint32_t blocks = (uint32_t)((bits + 511) / 512);
+	if (blocks == 0) blocks = 1;
+
+	/* Align the blocks to cache lines so every probe reads a single line */
+	size_t	  size	 = (size_t)blocks * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+	uint64_t* filter = (uint64_t*)aligned_alloc(64, size);
+	if (!filter) return -1;
+	memset(filter, 0, size);
+
+	free(store->filter);
+	store->filter		 = filter;
+	store->filter_blocks = blocks;
+
+	/* Add the hash of every indexed key */
+	for (size_t s = 0; s < (size_t)store->groups * GROUP_WIDTH; s++) {
+		if (store->ctrl[s] == CTRL_EMPTY) continue;
+		uint32_t i = store->slots[s];
+		filter_add(store, conf_hash(conf_store_key(store, i), NULL));
+	}
+	return 0;
+}
+
+int conf_store_finish(conf_store* store)
+{
+	/* Values added from now on are no longer shared */
+	free(store->intern);
+	store->intern	  = NULL;
+	store->intern_cap = 0;
+	store->interned	  = 0;
+
+	/* Drop the file buffer if no value refers to it */
+	if (store->spans == 0) {
+		free(store->source);
+		store->source	   = NULL;
+		store->source_size = 0;
+	}
+
+	return store_build_filter(store);
+}
+
+/**
+ * @brief Returns a bit mask of the control bytes in a group equal to a byte.
+ */
+static inline unsigned group_match(const unsigned char* group,
+								   unsigned char		byte)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+	return (unsigned)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < GROUP_WIDTH; i++) {
+		if (group[i] == byte) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/**
+ * @brief Returns the index slot of a key, or -1 if the key is not indexed.
+ *
+ * If @p empty is not NULL, it is set to the first empty slot on the probe
+ * sequence, which is where the key would be inserted.
+ */
+static long store_probe(const conf_store* store, const char* key,
+						uint64_t hash, uint32_t* empty)
+{
+	if (store->groups == 0) return -1;
+
+	unsigned char tag	= HASH_TAG(hash);
+	uint32_t	  gmask = store->groups - 1;
+	uint32_t	  g		= (uint32_t)hash & gmask;
+
+	/* Triangular probing visits every group of a power-of-two table */
+	for (uint32_t step = 1;; step++) {
+		const unsigned char* group = store->ctrl + (size_t)g * GROUP_WIDTH;
+
+		unsigned mask = group_match(group, tag);
+		while (mask) {
+			uint32_t slot = g * GROUP_WIDTH + __builtin_ctz(mask);
+			uint32_t i	  = store->slots[slot];
+			if (store->hashes[i] == (uint32_t)hash &&
+				strcmp(conf_store_key(store, i), key) == 0) {
+				return slot;
+			}
+			mask &= mask - 1;
+		}
+
+		/* An empty slot in the group ends the probe sequence */
+		unsigned free_mask = group_match(group, CTRL_EMPTY);
+		if (free_mask) {
+			if (empty) *empty = g * GROUP_WIDTH + __builtin_ctz(free_mask);
+			return -1;
+		}
+		g = (g + step) & gmask;
+	}
+}
+
+/**
+ * @brief Returns the first empty index slot on the probe sequence of a hash.
+ */
+static uint32_t store_empty_slot(const conf_store* store, uint32_t hash)
+{
+	uint32_t gmask = store->groups - 1;
+	uint32_t g	   = hash & gmask;
+
+	for (uint32_t step = 1;; step++) {
+		unsigned mask =
+			group_match(store->ctrl + (size_t)g * GROUP_WIDTH, CTRL_EMPTY);
+		if (mask) return g * GROUP_WIDTH + __builtin_ctz(mask);
+		g = (g + step) & gmask;
+	}
+}
+
+/**
+ * @brief Rebuilds the index with the given number of groups.
+ */
+static int store_rehash(conf_store* store, uint32_t groups)
+{
+	size_t		   nslots = (size_t)groups * GROUP_WIDTH;
+	unsigned char* ctrl	  = (unsigned char*)malloc(nslots);
+	uint32_t*	   slots  = (uint32_t*)malloc(nslots * sizeof(uint32_t));
+	if (!ctrl || !slots) {
+		free(ctrl);
+		free(slots);
+		return -1;
+	}
+	memset(ctrl, CTRL_EMPTY, nslots);
+
+	conf_store old = *store;
+	store->ctrl	   = ctrl;
+	store->slots   = slots;
+	store->groups  = groups;
+
+	/* Reinsert the indexed pairs, the keys are known to be distinct */
+	for (size_t s = 0; s < (size_t)old.groups * GROUP_WIDTH; s++) {
+		if (old.ctrl[s] == CTRL_EMPTY) continue;
+
+		uint32_t i			= old.slots[s];
+		uint32_t empty		= store_empty_slot(store, store->hashes[i]);
+		store->ctrl[empty]	= old.ctrl[s];
+		store->slots[empty] = i;
+	}
+
+	free(old.ctrl);
+	free(old.slots);
+	return 0;
+}
+
+/**
+ * @brief Grows the pair arrays of a store to hold at least one more pair.
+ */
+static int store_grow(conf_store* store)
+{
+	int cap = store->cap ? store->cap * 2 : STORE_INIT_PAIRS;
+
+	uint32_t* hashes =
+		(uint32_t*)realloc(store->hashes, cap * sizeof(uint32_t));
+	if (!hashes) return -1;
+	store->hashes = hashes;
+
+	uint32_t* key_offs =
+		(uint32_t*)realloc(store->key_offs, cap * sizeof(uint32_t));
+	if (!key_offs) return -1;
+	store->key_offs = key_offs;
+
+	unsigned char* types = (unsigned char*)realloc(store->types, cap);
+	if (!types) return -1;
+	store->types = types;
+
+	conf_value* values =
+		(conf_value*)realloc(store->values, cap * sizeof(conf_value));
+	if (!values) return -1;
+	store->values = values;
+
+	store->cap = cap;
+	return 0;
+}
+
+int conf_store_set_line(conf_store* store, int i, int line)
+{
+	/* The line array follows the capacity of the pair arrays */
+	if (store->lines_cap < store->cap) {
+		uint32_t* lines =
+			(uint32_t*)realloc(store->lines, store->cap * sizeof(uint32_t));
+		if (!lines) return -1;
+		memset(lines + store->lines_cap, 0,
+			   (store->cap - store->lines_cap) * sizeof(uint32_t));
+		store->lines	 = lines;
+		store->lines_cap = store->cap;
+	}
+	store->lines[i] = (uint32_t)line;
+	return 0;
+}
+
+int conf_store_add(conf_store* store, const char* key, size_t key_len,
+				   conf_type type, conf_value value)
+{
+	if (store->count == store->cap && store_grow(store) != 0) return -1;
+
+	/* Make room for the key and its terminator in the arena */
+	if (store->keys_len + key_len + 1 > store->keys_cap) {
+		size_t cap = store->keys_cap ? store->keys_cap : STORE_INIT_KEYS;
+		while (cap < store->keys_len + key_len + 1) {
+			cap *= 2;
+		}
+		char* keys = (char*)realloc(store->keys, cap);
+		if (!keys) return -1;
+		store->keys		= keys;
+		store->keys_cap = cap;
+	}
+
+	char* dst = store->keys + store->keys_len;
+	memcpy(dst, key, key_len);
+	dst[key_len] = '\0';
+
+	/* Keep the index at most 7/8 full */
+	if ((store->indexed + 1) * 8 > store->groups * GROUP_WIDTH * 7 &&
+		store_rehash(store, store->groups ? store->groups * 2 : 1) != 0) {
+		return -1;
+	}
+
+	uint64_t hash = conf_hash(dst, NULL);
+	uint32_t empty;
+	long	 found = store_probe(store, dst, hash, &empty);
+
+	int i				= store->count++;
+	store->hashes[i]	= (uint32_t)hash;
+	store->key_offs[i]	= (uint32_t)store->keys_len;
+	store->types[i]		= (unsigned char)type;
+	store->values[i]	= value;
+	store->keys_len	   += key_len + 1;
+
+	/* Only the first pair with a given key is indexed */
+	if (found < 0) {
+		store->ctrl[empty]	= HASH_TAG(hash);
+		store->slots[empty] = (uint32_t)i;
+		store->indexed++;
+		if (store->filter) filter_add(store, hash);
+	}
+	return 0;
+}
+
+char* conf_store_strdup(conf_store* store, const char* str, size_t len)
+{
+	conf_chunk* chunk = store->pool;
+
+	/* Start a new chunk if the string does not fit into the current one */
+	if (!chunk || chunk->size - chunk->used < len + 1) {
+		size_t size = len + 1 > POOL_CHUNK_SIZE ? len + 1 : POOL_CHUNK_SIZE;
+		chunk		= (conf_chunk*)malloc(sizeof(conf_chunk) + size);
+		if (!chunk) return NULL;
+		chunk->size = size;
+		chunk->used = 0;
+
+		/* Keep the current chunk in front if the new one is already full */
+		if (store->pool && size == len + 1) {
+			chunk->next		  = store->pool->next;
+			store->pool->next = chunk;
+		} else {
+			chunk->next = store->pool;
+			store->pool = chunk;
+		}
+	}
+
+	char* dst = chunk->data + chunk->used;
+	memcpy(dst, str, len);
+	dst[len]	 = '\0';
+	chunk->used += len + 1;
+	return dst;
+}
+
+/**
+ * @brief Grows the intern table of a store to twice its size.
+ */
+static int intern_grow(conf_store* store)
+{
+	size_t		 cap	= store->intern_cap ? store->intern_cap * 2
+											: INTERN_INIT_SIZE;
+	conf_intern* intern = (conf_intern*)calloc(cap, sizeof(conf_intern));
+	if (!intern) return -1;
+
+	for (size_t i = 0; i < store->intern_cap; i++) {
+		const conf_intern* entry = &store->intern[i];
+		if (!entry->str) continue;
+
+		size_t j = entry->hash & (cap - 1);
+		while (intern[j].str) {
+			j = (j + 1) & (cap - 1);
+		}
+		intern[j] = *entry;
+	}
+
+	free(store->intern);
+	store->intern	  = intern;
+	store->intern_cap = cap;
+	return 0;
+}
+
+/**
+ * @brief Returns the pooled copy of a string, sharing an equal copy if any.
+ */
+static char* store_intern(conf_store* store, const char* str, size_t len)
+{
+	/* Keep the intern table at most half full */
+	if ((store->interned + 1) * 2 > store->intern_cap &&
+		intern_grow(store) != 0) {
+		return NULL;
+	}
+
+	uint32_t hash = (uint32_t)conf_hash_bytes(str, len);
+	size_t	 mask = store->intern_cap - 1;
+	size_t	 j	  = hash & mask;
+	for (; store->intern[j].str; j = (j + 1) & mask) {
+		const conf_intern* entry = &store->intern[j];
+		if (entry->hash == hash && entry->len == len &&
+			memcmp(entry->str, str, len) == 0) {
+			store->shared++;
+			store->shared_bytes += len + 1;
+			return (char*)entry->str;
+		}
+	}
+
+	char* copy = conf_store_strdup(store, str, len);
+	if (!copy) return NULL;
+
+	store->intern[j].str  = copy;
+	store->intern[j].len  = (uint32_t)len;
+	store->intern[j].hash = hash;
+	store->interned++;
+	return copy;
+}
+
+int conf_store_add_string(conf_store* store, const char* key, size_t key_len,
+						  const char* str, size_t len)
+{
+	conf_value value;
+
+	/* Short strings are stored inline in the value slot */
+	if (len <= CONF_INLINE_MAX) {
+		memset(&value, 0, sizeof(value));
+		memcpy(&value, str, len);
+		if (conf_store_add(store, key, key_len, CONF_STRING, value) != 0) {
+			return -1;
+		}
+		store->types[store->count - 1] |= CONF_INLINE;
+		return 0;
+	}
+
+	/* Longer strings share a pooled copy until the store is finished */
+	value.str = store->filter ? conf_store_strdup(store, str, len)
+							  : store_intern(store, str, len);
+	if (!value.str) return -1;
+	return conf_store_add(store, key, key_len, CONF_STRING, value);
+}
+
+int conf_store_add_span(conf_store* store, const char* key, size_t key_len,
+						char* str, size_t len)
+{
+	if (len <= CONF_INLINE_MAX) {
+		return conf_store_add_string(store, key, key_len, str, len);
+	}
+
+	conf_value value;
+	value.str = str;
+	if (conf_store_add(store, key, key_len, CONF_STRING, value) != 0) {
+		return -1;
+	}
+	store->spans++;
+	return 0;
+}
+
+int conf_store_find(const conf_store* store, const char* key)
+{
+	return conf_store_find_hash(store, key, conf_hash(key, NULL));
+}
+
+int conf_store_find_hash(const conf_store* store, const char* key,
+						 uint64_t hash)
+{
+	if (!conf_store_filter_test(store, hash)) return -1;
+
+	long slot = store_probe(store, key, hash, NULL);
+	return slot < 0 ? -1 : (int)store->slots[slot];
+}
+
+void conf_store_stats(const conf_store* store, conf_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->pairs		  = store->count;
+	stats->shared_strings = store->shared;
+	stats->saved_bytes	  = store->shared_bytes;
+
+	/* Scan the type tags for string values */
+	for (int i = 0; i < store->count; i++) {
+		if (conf_store_type(store, i) != CONF_STRING) continue;
+		stats->strings++;
+		if (store->types[i] & CONF_INLINE) stats->inline_strings++;
+	}
+
+	/* Pair arrays, key arena, index, filter, intern table and string pool */
+	size_t pair_size = 2 * sizeof(uint32_t) + 1 + sizeof(conf_value);
+	size_t total	 = sizeof(conf_store) + store->keys_cap;
+	total += (size_t)store->cap * pair_size;
+	total += (size_t)store->groups * GROUP_WIDTH * (1 + sizeof(uint32_t));
+	total += (size_t)store->filter_blocks * FILTER_BLOCK_WORDS * 8;
+	total += store->intern_cap * sizeof(conf_intern);
+	total += (size_t)store->lines_cap * sizeof(uint32_t);
+	if (store->source) total += store->source_size + 1;
+	if (store->image) total = sizeof(conf_store) + store->image_size;
+	for (const conf_chunk* chunk = store->pool; chunk; chunk = chunk->next) {
+		stats->pool_bytes += chunk->used;
+		total			  += sizeof(conf_chunk) + chunk->size;
+	}
+	stats->total_bytes = total;
+}
+
+/**
+ * @brief Header of a store image, followed by the arrays of the store.
+ *
+ * All offsets are relative to the start of the image, so the image can be
+ * mapped at any address. String values that are not stored inline hold the
+ * offset of their string in the value slot.
+ */
+typedef struct {
+	uint32_t magic;			/**< IMAGE_MAGIC */
+	uint32_t count;			/**< Number of pairs */
+	uint32_t groups;		/**< Number of 16-slot index groups */
+	uint32_t indexed;		/**< Number of occupied index slots */
+	uint32_t filter_blocks; /**< Number of 64-byte filter blocks */
+	uint32_t reserved;		/**< Zero */
+	uint64_t keys_len;		/**< Size of the key arena */
+	uint64_t strings_len;	/**< Size of the string area */
+	uint64_t hashes;		/**< Offset of the key hashes */
+	uint64_t key_offs;		/**< Offset of the key offsets */
+	uint64_t types;			/**< Offset of the type tags */
+	uint64_t values;		/**< Offset of the values */
+	uint64_t keys;			/**< Offset of the key arena */
+	uint64_t ctrl;			/**< Offset of the control bytes */
+	uint64_t slots;			/**< Offset of the index slots */
+	uint64_t filter;		/**< Offset of the filter blocks */
+	uint64_t strings;		/**< Offset of the string area */
+} store_image;
+
+/* Magic number of a store image, changed with every change of the layout */
+#define IMAGE_MAGIC 0x43464931 /* "CFI1" */
+
+/* Alignment of the sections of an image, a cache line as for the filter */
+#define IMAGE_ALIGN 64
+
+/**
+ * @brief Reserves an aligned section of an image, returns its offset.
+ */
+static uint64_t image_section(size_t* size, size_t len)
+{
+	uint64_t offset = (*size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+	*size			= offset + len;
+	return offset;
+}
+
+/**
+ * @brief Returns the string area offset of a pooled string, adding it once.
+ *
+ * Values that share a pooled copy share it in the image as well: @p seen maps
+ * string addresses to their offsets with open addressing.
+ */
+static uint64_t image_string(char* image, const store_image* hdr,
+							 uint64_t* len, const char** seen,
+							 uint64_t* offs, size_t mask, const char* str)
+{
+	size_t h = (size_t)(conf_hash_bytes((const char*)&str, sizeof(str)) & mask);
+	while (seen[h] && seen[h] != str) {
+		h = (h + 1) & mask;
+	}
+	if (seen[h]) return offs[h];
+
+	size_t n = strlen(str) + 1;
+	seen[h]	 = str;
+	offs[h]	 = hdr->strings + *len;
+	if (image) memcpy(image + offs[h], str, n);
+	*len += n;
+	return offs[h];
+}
+
+/**
+ * @brief Lays out the image of a store, and fills it in if @p image is set.
+ *
+ * @return Size of the image, 0 on allocation failure.
+ */
+static size_t image_layout(const conf_store* store, size_t offset,
+						   store_image* hdr, char* image)
+{
+	size_t count  = (size_t)store->count;
+	size_t nslots = (size_t)store->groups * GROUP_WIDTH;
+	size_t size	  = offset + sizeof(store_image);
+
+	hdr->magic		   = IMAGE_MAGIC;
+	hdr->count		   = (uint32_t)count;
+	hdr->groups		   = store->groups;
+	hdr->indexed	   = store->indexed;
+	hdr->filter_blocks = store->filter_blocks;
+	hdr->keys_len	   = store->keys_len;
+	hdr->hashes		   = image_section(&size, count * sizeof(uint32_t));
+	hdr->key_offs	   = image_section(&size, count * sizeof(uint32_t));
+	hdr->types		   = image_section(&size, count);
+	hdr->values		   = image_section(&size, count * sizeof(conf_value));
+	hdr->keys		   = image_section(&size, store->keys_len);
+	hdr->ctrl		   = image_section(&size, nslots);
+	hdr->slots		   = image_section(&size, nslots * sizeof(uint32_t));
+	hdr->filter		   = image_section(
+		   &size, (size_t)store->filter_blocks * FILTER_BLOCK_WORDS * 8);
+	hdr->strings = image_section(&size, 0);
+
+	/* Collect the pooled strings, each shared copy once */
+	size_t strings = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (store->types[i] == CONF_STRING) strings++;
+	}
+	size_t mask = 1;
+	while (mask < strings * 2) {
+		mask <<= 1;
+	}
+	const char** seen = (const char**)calloc(mask, sizeof(*seen));
+	uint64_t*	 offs = (uint64_t*)malloc(mask * sizeof(*offs));
+	if (!seen || !offs) {
+		free(seen);
+		free(offs);
+		return 0;
+	}
+
+	uint64_t len	= 0;
+	uint64_t values = hdr->values;
+	for (size_t i = 0; i < count; i++) {
+		conf_value value = store->values[i];
+		if (store->types[i] == CONF_STRING) {
+			value.lval = (long)image_string(image, hdr, &len, seen, offs,
+											mask - 1, value.str);
+		}
+		if (image) memcpy(image + values + i * sizeof(value), &value, 8);
+	}
+	free(seen);
+	free(offs);
+	hdr->strings_len = len;
+
+	if (image) {
+		memcpy(image + offset, hdr, sizeof(*hdr));
+		memcpy(image + hdr->hashes, store->hashes, count * sizeof(uint32_t));
+		memcpy(image + hdr->key_offs, store->key_offs,
+			   count * sizeof(uint32_t));
+		memcpy(image + hdr->types, store->types, count);
+		memcpy(image + hdr->keys, store->keys, store->keys_len);
+		memcpy(image + hdr->ctrl, store->ctrl, nslots);
+		memcpy(image + hdr->slots, store->slots, nslots * sizeof(uint32_t));
+		memcpy(image + hdr->filter, store->filter,
+			   (size_t)store->filter_blocks * FILTER_BLOCK_WORDS * 8);
+	}
+	return hdr->strings + len;
+}
+
+char* conf_store_save(const conf_store* store, size_t offset, size_t* size)
+{
+	/* Lay out the image once to size it, then again to fill it in */
+	store_image hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	*size = image_layout(store, offset, &hdr, NULL);
+	if (*size == 0) return NULL;
+
+	char* image = (char*)calloc(1, *size);
+	if (!image) return NULL;
+	if (image_layout(store, offset, &hdr, image) != *size) {
+		free(image);
+		return NULL;
+	}
+	return image;
+}
+
+/**
+ * @brief Checks that a section of the given length lies within an image.
+ */
+static int image_fits(uint64_t offset, uint64_t len, size_t size)
+{
+	return offset <= size && len <= size - offset;
+}
+
+conf_store* conf_store_map(void* image, size_t size, size_t offset)
+{
+	char*		data = (char*)image;
+	store_image hdr;
+	if (!image_fits(offset, sizeof(hdr), size)) return NULL;
+	memcpy(&hdr, data + offset, sizeof(hdr));
+
+	/* Reject images of another layout, and sections out of bounds */
+	uint64_t count	= hdr.count;
+	uint64_t nslots = (uint64_t)hdr.groups * GROUP_WIDTH;
+	if (hdr.magic != IMAGE_MAGIC || count > INT32_MAX ||
+		(hdr.groups & (hdr.groups - 1)) != 0 ||
+		!image_fits(hdr.hashes, count * 4, size) ||
+		!image_fits(hdr.key_offs, count * 4, size) ||
+		!image_fits(hdr.types, count, size) ||
+		!image_fits(hdr.values, count * 8, size) ||
+		!image_fits(hdr.keys, hdr.keys_len, size) ||
+		!image_fits(hdr.ctrl, nslots, size) ||
+		!image_fits(hdr.slots, nslots * 4, size) ||
+		!image_fits(hdr.filter, (uint64_t)hdr.filter_blocks * 64, size) ||
+		!image_fits(hdr.strings, hdr.strings_len, size) ||
+		(hdr.filter & (IMAGE_ALIGN - 1)) != 0 || hdr.filter_blocks == 0 ||
+		(hdr.keys_len > 0 && data[hdr.keys + hdr.keys_len - 1] != '\0')) {
+		return NULL;
+	}
+
+	conf_store* store = conf_store_new();
+	if (!store) return NULL;
+	store->hashes		 = (uint32_t*)(data + hdr.hashes);
+	store->key_offs		 = (uint32_t*)(data + hdr.key_offs);
+	store->types		 = (unsigned char*)(data + hdr.types);
+	store->values		 = (conf_value*)(data + hdr.values);
+	store->keys			 = data + hdr.keys;
+	store->keys_len		 = hdr.keys_len;
+	store->keys_cap		 = hdr.keys_len;
+	store->count		 = (int)count;
+	store->cap			 = (int)count;
+	store->ctrl			 = (unsigned char*)(data + hdr.ctrl);
+	store->slots		 = (uint32_t*)(data + hdr.slots);
+	store->groups		 = hdr.groups;
+	store->indexed		 = hdr.indexed;
+	store->filter		 = (uint64_t*)(data + hdr.filter);
+	store->filter_blocks = hdr.filter_blocks;
+
+	/* Relocate the pooled strings, and check all references */
+	int valid = 1;
+	for (uint64_t i = 0; i < count && valid; i++) {
+		valid = store->key_offs[i] < hdr.keys_len;
+		if (store->types[i] != CONF_STRING) continue;
+		uint64_t off = (uint64_t)store->values[i].lval;
+		valid		 = valid && off >= hdr.strings &&
+				off < hdr.strings + hdr.strings_len &&
+				memchr(data + off, '\0', hdr.strings + hdr.strings_len - off);
+		if (valid) store->values[i].str = data + off;
+	}
+
+	/* Probes only end at an empty slot, so a full index would never end */
+	int empty = nslots == 0;
+	for (uint64_t s = 0; s < nslots && valid; s++) {
+		empty |= store->ctrl[s] == CTRL_EMPTY;
+		valid  = store->ctrl[s] == CTRL_EMPTY || store->slots[s] < count;
+	}
+	if (!valid || !empty) {
+		free(store);
+		return NULL;
+	}
+
+	store->image	  = image;
+	store->image_size = size;
+	return store;
+}
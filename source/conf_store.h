@@ -0,0 +1,330 @@
+/**
+ * @file conf_store.h
+ * @brief Internal pair storage of the libconf library.
+ *
+ * The pairs of a conf_data struct are kept in a structure-of-arrays layout:
+ * one array each for the key hashes, the key offsets into a shared key arena,
+ * the type tags, and the 8-byte values. Scans over types or values never touch
+ * the keys.
+ *
+ * Keys are indexed by a SwissTable-style hash table: every slot has a control
+ * byte holding a 7-bit tag of the key hash, and slots are probed in groups of
+ * 16 whose control bytes are compared with a single SSE2 instruction. Lookups
+ * of absent keys usually end at the first group without touching a key.
+ *
+ * String values of up to CONF_INLINE_MAX bytes are stored inline in their
+ * 8-byte value slot, so reading them does not touch another cache line. Longer
+ * strings are copied into a pool of large chunks owned by the store. While a
+ * store is being loaded, an intern table maps pooled strings to their copy, so
+ * repeated values share a single copy in the pool. Quoted values are not
+ * copied at all: they stay in the loaded file buffer as spans, and the store
+ * keeps the buffer alive as long as any span refers to it.
+ *
+ * Once a store is loaded, a blocked Bloom filter is built over its keys. Each
+ * key sets a few bits within a single 64-byte block, so most lookups of absent
+ * keys are rejected after reading one cache line.
+ *
+ * A store may also be mapped from a cache image, in which case all arrays live
+ * in the mapping and the store must not be modified.
+ */
+
+#ifndef CONF_STORE_H
+#define CONF_STORE_H
+
+#include "libconf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Flag in the type tag of string values stored inline in the value slot */
+#define CONF_INLINE 0x80
+
+/** Maximum length of a string value stored inline */
+#define CONF_INLINE_MAX (sizeof(conf_value) - 1)
+
+/**
+ * @brief Chunk of the string pool of a store.
+ */
+typedef struct conf_chunk {
+	struct conf_chunk*	next;	/**< Next chunk of the pool */
+	size_t				size;	/**< Capacity of the chunk */
+	size_t				used;	/**< Number of used bytes in the chunk */
+	char				data[];	/**< Pooled strings */
+} conf_chunk;
+
+/**
+ * @brief Entry of the intern table of pooled strings.
+ */
+typedef struct {
+	const char*	str;	/**< Pooled string, NULL for an empty entry */
+	uint32_t	len;	/**< Length of the string */
+	uint32_t	hash;	/**< Hash of the string */
+} conf_intern;
+
+/**
+ * @brief Structure-of-arrays storage for key-value pairs.
+ */
+struct conf_store {
+	uint32_t*		hashes;			/**< Hash of each key */
+	uint32_t*		key_offs;		/**< Offset of each key in the arena */
+	unsigned char*	types;			/**< Type tag of each value */
+	conf_value*		values;			/**< Value of each pair */
+	char*			keys;			/**< Key arena, keys are NUL-terminated */
+	size_t			keys_len;		/**< Used bytes in the key arena */
+	size_t			keys_cap;		/**< Capacity of the key arena */
+	int				count;			/**< Number of pairs */
+	int				cap;			/**< Capacity of the pair arrays */
+	unsigned char*	ctrl;			/**< Control byte of each index slot */
+	uint32_t*		slots;			/**< Pair index of each index slot */
+	uint32_t		groups;			/**< Number of 16-slot index groups */
+	uint32_t		indexed;		/**< Number of occupied index slots */
+	uint64_t*		filter;			/**< Blocked Bloom filter over the keys */
+	uint32_t		filter_blocks;	/**< Number of 64-byte filter blocks */
+	conf_chunk*		pool;			/**< String pool, newest chunk first */
+	conf_intern*	intern;			/**< Intern table, freed once loaded */
+	size_t			intern_cap;		/**< Capacity of the intern table */
+	size_t			interned;		/**< Number of interned strings */
+	size_t			shared;			/**< Number of values sharing a copy */
+	size_t			shared_bytes;	/**< Pool bytes saved by sharing */
+	char*			source;			/**< Loaded file buffer */
+	size_t			source_size;	/**< Size of the loaded file buffer */
+	size_t			spans;			/**< Number of values in the buffer */
+	int				refs;			/**< References to the owning conf_data */
+	void*			image;			/**< Mapped cache image of the arrays */
+	size_t			image_size;		/**< Size of the mapped cache image */
+	uint32_t*		lines;			/**< Source line of each pair, or NULL */
+	int				lines_cap;		/**< Capacity of the line array */
+};
+
+/**
+ * @brief Hashes a NUL-terminated key.
+ *
+ * @param[in]  key Key string.
+ * @param[out] len Length of the key, may be NULL.
+ *
+ * @return 64-bit hash of the key.
+ */
+uint64_t conf_hash(const char* key, size_t* len);
+
+/**
+ * @brief Hashes a string of the given length.
+ *
+ * @param[in] str String, does not need to be NUL-terminated.
+ * @param[in] len Length of the string.
+ *
+ * @return 64-bit hash of the string.
+ */
+uint64_t conf_hash_bytes(const char* str, size_t len);
+
+/**
+ * @brief Allocates an empty store.
+ *
+ * @return Pointer to the store on success, NULL on failure.
+ */
+conf_store* conf_store_new(void);
+
+/**
+ * @brief Frees a store together with its string pool.
+ *
+ * @param[in] store Pointer to the store to free.
+ */
+void conf_store_free(conf_store* store);
+
+/**
+ * @brief Appends a pair to the store.
+ *
+ * Only the first pair with a given key is indexed, so later duplicates are
+ * stored but never found by conf_store_find().
+ *
+ * @param[in] store   Pointer to the store.
+ * @param[in] key     Key, does not need to be NUL-terminated.
+ * @param[in] key_len Length of the key.
+ * @param[in] type    Type of the value.
+ * @param[in] value   Value; string values must be added with
+ *                    conf_store_add_string() instead.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conf_store_add(conf_store* store, const char* key, size_t key_len,
+				   conf_type type, conf_value value);
+
+/**
+ * @brief Appends a pair with a string value to the store.
+ *
+ * The string is stored inline if it is short enough. Otherwise it shares the
+ * pooled copy of an equal string, or is copied into the string pool.
+ *
+ * @param[in] store   Pointer to the store.
+ * @param[in] key     Key, does not need to be NUL-terminated.
+ * @param[in] key_len Length of the key.
+ * @param[in] str     String value, does not need to be NUL-terminated.
+ * @param[in] len     Length of the string value.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conf_store_add_string(conf_store* store, const char* key, size_t key_len,
+						  const char* str, size_t len);
+
+/**
+ * @brief Appends a pair with a string value referring to the file buffer.
+ *
+ * The string is stored inline if it is short enough, otherwise the value
+ * refers to the string in place.
+ *
+ * @param[in] store   Pointer to the store.
+ * @param[in] key     Key, does not need to be NUL-terminated.
+ * @param[in] key_len Length of the key.
+ * @param[in] str     NUL-terminated string inside the buffer of the store.
+ * @param[in] len     Length of the string value.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conf_store_add_span(conf_store* store, const char* key, size_t key_len,
+						char* str, size_t len);
+
+/**
+ * @brief Records the source line of a pair.
+ *
+ * Lines are only kept for stores that record them, pairs whose line was not
+ * recorded have line 0.
+ *
+ * @param[in] store Pointer to the store.
+ * @param[in] i     Index of the pair.
+ * @param[in] line  Line of the pair in the loaded file, starting at 1.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conf_store_set_line(conf_store* store, int i, int line);
+
+/**
+ * @brief Copies a string into the string pool of a store.
+ *
+ * @param[in] store Pointer to the store.
+ * @param[in] str   String, does not need to be NUL-terminated.
+ * @param[in] len   Length of the string.
+ *
+ * @return Pointer to the NUL-terminated copy, NULL on allocation failure.
+ */
+char* conf_store_strdup(conf_store* store, const char* str, size_t len);
+
+/**
+ * @brief Finds the first pair with the given key.
+ *
+ * @param[in] store Pointer to the store.
+ * @param[in] key   Key string.
+ *
+ * @return Index of the pair, or -1 if the key is not stored.
+ */
+int conf_store_find(const conf_store* store, const char* key);
+
+/**
+ * @brief Finds the first pair with the given key and precomputed key hash.
+ *
+ * @param[in] store Pointer to the store.
+ * @param[in] key   Key string.
+ * @param[in] hash  Hash of the key as returned by conf_hash().
+ *
+ * @return Index of the pair, or -1 if the key is not stored.
+ */
+int conf_store_find_hash(const conf_store* store, const char* key,
+						 uint64_t hash);
+
+/**
+ * @brief Finishes loading a store.
+ *
+ * Builds the Bloom filter over the keys of the store, frees the intern table,
+ * and frees the file buffer unless values refer to it. Pairs added afterwards
+ * are still added to the filter, but the false-positive rate grows beyond the
+ * one the filter was sized for, and their string values are no longer shared.
+ *
+ * @param[in] store Pointer to the store.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+int conf_store_finish(conf_store* store);
+
+/**
+ * @brief Checks whether a key hash may be stored according to the filter.
+ *
+ * @param[in] store Pointer to the store.
+ * @param[in] hash  Hash of the key as returned by conf_hash().
+ *
+ * @return 0 if the key is certainly not stored, 1 if it may be stored or the
+ * store has no filter.
+ */
+int conf_store_filter_test(const conf_store* store, uint64_t hash);
+
+/**
+ * @brief Gets memory statistics of a store.
+ *
+ * @param[in]  store Pointer to the store.
+ * @param[out] stats Pointer to the statistics to fill in.
+ */
+void conf_store_stats(const conf_store* store, conf_stats* stats);
+
+/**
+ * @brief Saves a finished store as a relocatable image.
+ *
+ * @param[in]  store  Pointer to the store.
+ * @param[in]  offset Number of zeroed bytes to reserve in front of the image,
+ *                    a multiple of 64.
+ * @param[out] size   Size of the image including the reserved bytes.
+ *
+ * @return Pointer to the image allocated with malloc(), NULL on allocation
+ * failure.
+ */
+char* conf_store_save(const conf_store* store, size_t offset, size_t* size);
+
+/**
+ * @brief Creates a store over a writable private mapping of an image.
+ *
+ * The arrays of the store point into the mapping, and string values are
+ * relocated in place. On success, the store owns the mapping and unmaps it
+ * when freed.
+ *
+ * @param[in] image  Start of the mapping, aligned to a page.
+ * @param[in] size   Size of the mapping.
+ * @param[in] offset Offset of the image saved by conf_store_save().
+ *
+ * @return Pointer to the store, NULL if the image is invalid or on allocation
+ * failure.
+ */
+conf_store* conf_store_map(void* image, size_t size, size_t offset);
+
+/**
+ * @brief Returns the key of the pair at the given index.
+ */
+static inline const char* conf_store_key(const conf_store* store, int i)
+{
+	return store->keys + store->key_offs[i];
+}
+
+/**
+ * @brief Returns the type of the pair at the given index.
+ */
+static inline conf_type conf_store_type(const conf_store* store, int i)
+{
+	return (conf_type)(store->types[i] & ~CONF_INLINE);
+}
+
+/**
+ * @brief Returns the source line of the pair at the given index, or 0 if it
+ * was not recorded.
+ */
+static inline int conf_store_line(const conf_store* store, int i)
+{
+	return i < store->lines_cap ? (int)store->lines[i] : 0;
+}
+
+/**
+ * @brief Returns the string value of the pair at the given index.
+ *
+ * The pair must have the type CONF_STRING.
+ */
+static inline char* conf_store_string(const conf_store* store, int i)
+{
+	return (store->types[i] & CONF_INLINE) ? (char*)&store->values[i]
+										   : store->values[i].str;
+}
+
+#endif /* CONF_STORE_H */
@@ -0,0 +1,519 @@
+/**
+ * @file conf_trie.c
+ * @brief Runtime overrides of configuration data for the libconf library.
+ *
+ * conf_set() and conf_remove() never modify their input. They insert a leaf
+ * into a copy of the path from the root of the trie to the leaf, and wrap the
+ * new root in a new version that shares the loaded data and all other nodes
+ * with its predecessor. Readers of a version therefore need no locks, and a
+ * version stays valid for as long as a reference to it is held.
+ */
+
+#include "conf_trie.h"
+#include "conf_store.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bits of the key hash consumed by each level of the trie */
+#define TRIE_BITS 5
+
+/* Bits of the key hash, deeper nodes are collision nodes */
+#define HASH_BITS 64
+
+/**
+ * @brief Returns the entry of a hash at the level with the given shift.
+ */
+static unsigned trie_bit(uint64_t hash, unsigned shift)
+{
+	return (unsigned)(hash >> shift) & ((1u << TRIE_BITS) - 1);
+}
+
+/**
+ * @brief Returns the position of an entry in the packed entry array.
+ */
+static int trie_index(uint32_t bitmap, unsigned bit)
+{
+	return __builtin_popcount(bitmap & ((1u << bit) - 1));
+}
+
+/**
+ * @brief Allocates a node with room for the given number of entries.
+ */
+static conf_trie* node_new(int entries)
+{
+	conf_trie* node =
+		(conf_trie*)calloc(1, sizeof(conf_trie) + entries * sizeof(void*));
+	if (node) node->refs = 1;
+	return node;
+}
+
+/**
+ * @brief Takes another reference to an entry of a node.
+ */
+static void entry_retain(void* entry)
+{
+	/* Leaves and nodes both start with their reference count */
+	__atomic_add_fetch((int*)entry, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Drops a reference to a leaf, freeing it with the last one.
+ */
+static void leaf_release(conf_leaf* leaf)
+{
+	if (__atomic_sub_fetch(&leaf->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+	if (!leaf->removed && leaf->pair.type == CONF_STRING) {
+		free(leaf->pair.value.str);
+	}
+	free(leaf);
+}
+
+/**
+ * @brief Drops a reference to a node, freeing the unshared part of its
+ * subtree with the last one.
+ */
+static void node_release(conf_trie* node)
+{
+	if (!node || __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	int i = 0;
+	for (uint32_t m = node->bitmap; m; m &= m - 1, i++) {
+		if (node->leaves & (m & -m)) {
+			leaf_release((conf_leaf*)node->entries[i]);
+		} else {
+			node_release((conf_trie*)node->entries[i]);
+		}
+	}
+	free(node);
+}
+
+/**
+ * @brief Copies a node with an entry added or replaced.
+ *
+ * @param[in] node    Node to copy, NULL for an empty node.
+ * @param[in] bit     Entry to set.
+ * @param[in] entry   Child node or leaf, the copy takes over the reference.
+ * @param[in] is_leaf Whether @p entry is a leaf.
+ *
+ * @return Pointer to the copy, NULL on allocation failure.
+ */
+static conf_trie* node_with(const conf_trie* node, unsigned bit, void* entry,
+							int is_leaf)
+{
+	uint32_t mask	 = 1u << bit;
+	uint32_t bitmap	 = node ? node->bitmap : 0;
+	int		 count	 = __builtin_popcount(bitmap);
+	int		 at		 = trie_index(bitmap, bit);
+	int		 replace = (bitmap & mask) != 0;
+
+	conf_trie* copy = node_new(count + !replace);
+	if (!copy) return NULL;
+	copy->bitmap = bitmap | mask;
+	copy->leaves = node ? node->leaves & ~mask : 0;
+	if (is_leaf) copy->leaves |= mask;
+
+	/* Share all other entries with the original */
+	for (int i = 0; i < count; i++) {
+		if (replace && i == at) continue;
+		entry_retain(node->entries[i]);
+		copy->entries[i + (!replace && i >= at)] = node->entries[i];
+	}
+	copy->entries[at] = entry;
+	return copy;
+}
+
+/**
+ * @brief Copies a node with an entry removed.
+ *
+ * @param[in]  node Node to copy.
+ * @param[in]  bit  Occupied entry to remove.
+ * @param[out] out  Copy, NULL if it would be empty.
+ *
+ * @return 0 on success, -1 on allocation failure.
+ */
+static int node_without(const conf_trie* node, unsigned bit, conf_trie** out)
+{
+	uint32_t mask  = 1u << bit;
+	int		 count = __builtin_popcount(node->bitmap);
+	int		 at	   = trie_index(node->bitmap, bit);
+
+	*out = NULL;
+	if (count == 1) return 0;
+
+	conf_trie* copy = node_new(count - 1);
+	if (!copy) return -1;
+	copy->bitmap = node->bitmap & ~mask;
+	copy->leaves = node->leaves & ~mask;
+	for (int i = 0; i < count; i++) {
+		if (i == at) continue;
+		entry_retain(node->entries[i]);
+		copy->entries[i - (i > at)] = node->entries[i];
+	}
+	*out = copy;
+	return 0;
+}
+
+/**
+ * @brief Finds the entry of a key in a collision node.
+ *
+ * @return Entry of the key, or -1 if the key is not in the node.
+ */
+static int collision_find(const conf_trie* node, const char* key)
+{
+	int i = 0;
+	for (uint32_t m = node ? node->bitmap : 0; m; m &= m - 1, i++) {
+		const conf_leaf* leaf = (const conf_leaf*)node->entries[i];
+		if (strcmp(leaf->pair.key, key) == 0) return __builtin_ctz(m);
+	}
+	return -1;
+}
+
+/**
+ * @brief Inserts a leaf into a copy of a subtree.
+ *
+ * @param[in] node  Root of the subtree, NULL for an empty one.
+ * @param[in] leaf  Leaf to insert, the reference is taken over even on
+ *                  failure.
+ * @param[in] shift Bits of the hash consumed above @p node.
+ *
+ * @return Root of the copy, NULL on allocation failure.
+ */
+static conf_trie* trie_insert(const conf_trie* node, conf_leaf* leaf,
+							  unsigned shift)
+{
+	conf_trie* copy;
+
+	/* Keys with equal hashes share a node, which is searched linearly */
+	if (shift >= HASH_BITS) {
+		int bit = collision_find(node, leaf->pair.key);
+		if (bit < 0 && node && node->bitmap == UINT32_MAX) {
+			leaf_release(leaf);
+			return NULL;
+		}
+		if (bit < 0) bit = node ? __builtin_ctz(~node->bitmap) : 0;
+		copy = node_with(node, (unsigned)bit, leaf, 1);
+		if (!copy) leaf_release(leaf);
+		return copy;
+	}
+
+	unsigned bit  = trie_bit(leaf->hash, shift);
+	uint32_t mask = 1u << bit;
+	if (!node || !(node->bitmap & mask)) {
+		copy = node_with(node, bit, leaf, 1);
+		if (!copy) leaf_release(leaf);
+		return copy;
+	}
+
+	/* Descend into child nodes, and replace leaves of the same key */
+	void*	   entry = node->entries[trie_index(node->bitmap, bit)];
+	conf_trie* child;
+	if (!(node->leaves & mask)) {
+		child = trie_insert((const conf_trie*)entry, leaf, shift + TRIE_BITS);
+	} else if (((conf_leaf*)entry)->hash == leaf->hash &&
+			   strcmp(((conf_leaf*)entry)->pair.key, leaf->pair.key) == 0) {
+		copy = node_with(node, bit, leaf, 1);
+		if (!copy) leaf_release(leaf);
+		return copy;
+	} else {
+		/* Push the existing leaf down into a node of its own */
+		entry_retain(entry);
+		conf_trie* pushed =
+			trie_insert(NULL, (conf_leaf*)entry, shift + TRIE_BITS);
+		if (!pushed) {
+			leaf_release(leaf);
+			return NULL;
+		}
+		child = trie_insert(pushed, leaf, shift + TRIE_BITS);
+		node_release(pushed);
+	}
+	if (!child) return NULL;
+
+	copy = node_with(node, bit, child, 0);
+	if (!copy) node_release(child);
+	return copy;
+}
+
+/**
+ * @brief Removes the leaf of a key from a copy of a subtree.
+ *
+ * @param[in]  node  Root of the subtree.
+ * @param[in]  key   Key string.
+ * @param[in]  hash  Hash of the key.
+ * @param[in]  shift Bits of the hash consumed above @p node.
+ * @param[out] out   Root of the copy, NULL if it would be empty.
+ *
+ * @return 0 on success, 1 if the key is not in the subtree, -1 on allocation
+ * failure.
+ */
+static int trie_delete(const conf_trie* node, const char* key, uint64_t hash,
+					   unsigned shift, conf_trie** out)
+{
+	if (shift >= HASH_BITS) {
+		int bit = collision_find(node, key);
+		return bit < 0 ? 1 : node_without(node, (unsigned)bit, out);
+	}
+
+	unsigned bit  = trie_bit(hash, shift);
+	uint32_t mask = 1u << bit;
+	if (!(node->bitmap & mask)) return 1;
+
+	void* entry = node->entries[trie_index(node->bitmap, bit)];
+	if (node->leaves & mask) {
+		const conf_leaf* leaf = (const conf_leaf*)entry;
+		if (leaf->hash != hash || strcmp(leaf->pair.key, key) != 0) return 1;
+		return node_without(node, bit, out);
+	}
+
+	conf_trie* child;
+	int rc = trie_delete((const conf_trie*)entry, key, hash, shift + TRIE_BITS,
+						 &child);
+	if (rc != 0) return rc;
+	if (!child) return node_without(node, bit, out);
+
+	*out = node_with(node, bit, child, 0);
+	if (!*out) {
+		node_release(child);
+		return -1;
+	}
+	return 0;
+}
+
+const conf_leaf* conf_trie_find(const conf_trie* root, const char* key,
+								uint64_t hash)
+{
+	const conf_trie* node = root;
+	for (unsigned shift = 0; node; shift += TRIE_BITS) {
+		if (shift >= HASH_BITS) {
+			int bit = collision_find(node, key);
+			if (bit < 0) return NULL;
+			return (const conf_leaf*)
+				node->entries[trie_index(node->bitmap, (unsigned)bit)];
+		}
+
+		unsigned bit  = trie_bit(hash, shift);
+		uint32_t mask = 1u << bit;
+		if (!(node->bitmap & mask)) return NULL;
+
+		void* entry = node->entries[trie_index(node->bitmap, bit)];
+		if (node->leaves & mask) {
+			const conf_leaf* leaf = (const conf_leaf*)entry;
+			return leaf->hash == hash && strcmp(leaf->pair.key, key) == 0
+					   ? leaf
+					   : NULL;
+		}
+		node = (const conf_trie*)entry;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Calls a function for the pairs of the leaves of a trie.
+ *
+ * @return 0 if all leaves were visited, the nonzero result of @p visit
+ * otherwise.
+ */
+static int trie_walk(const conf_trie* node, conf_pair_fn visit, void* ctx)
+{
+	int i = 0;
+	for (uint32_t m = node ? node->bitmap : 0; m; m &= m - 1, i++) {
+		int rc = 0;
+		if (node->leaves & (m & -m)) {
+			const conf_leaf* leaf = (const conf_leaf*)node->entries[i];
+			if (!leaf->removed) {
+				rc = visit(leaf->pair.key, leaf->pair.type, leaf->pair.value,
+						   ctx);
+			}
+		} else {
+			rc = trie_walk((const conf_trie*)node->entries[i], visit, ctx);
+		}
+		if (rc != 0) return rc;
+	}
+	return 0;
+}
+
+int conf_pairs_walk(const conf_data* data, conf_pair_fn visit, void* ctx)
+{
+	const conf_store* store = data->store;
+	const conf_trie*  root	= data->overrides ? data->overrides->root : NULL;
+
+	for (int i = 0; i < store->count; i++) {
+		const char* key	 = conf_store_key(store, i);
+		uint64_t	hash = conf_hash(key, NULL);
+		if (conf_store_find_hash(store, key, hash) != i ||
+			conf_trie_find(root, key, hash)) {
+			continue;
+		}
+
+		conf_value value = store->values[i];
+		conf_type  type	 = conf_store_type(store, i);
+		if (type == CONF_STRING) value.str = conf_store_string(store, i);
+		int rc = visit(key, type, value, ctx);
+		if (rc != 0) return rc;
+	}
+
+	return trie_walk(root, visit, ctx);
+}
+
+int conf_overrides_release(conf_overrides* overrides)
+{
+	if (__atomic_sub_fetch(&overrides->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return 0;
+	}
+
+	node_release(overrides->root);
+	conf_free(overrides->base);
+	free(overrides);
+	return 1;
+}
+
+/**
+ * @brief Returns the loaded data a version is based on.
+ */
+static conf_data* version_base(conf_data* data)
+{
+	return data->overrides ? data->overrides->base : data;
+}
+
+/**
+ * @brief Wraps a new root of the trie in a new version.
+ *
+ * @param[in] data  Version the new one is derived from.
+ * @param[in] root  Root of the trie, the version takes over the reference.
+ * @param[in] count Number of pairs in the new version.
+ *
+ * @return Pointer to the new version, NULL on allocation failure.
+ */
+static conf_data* version_new(conf_data* data, conf_trie* root, int count)
+{
+	conf_data* base = version_base(data);
+
+	/* Without overrides left, the version is the loaded data */
+	if (!root) return conf_retain(base);
+
+	conf_data*		version = (conf_data*)malloc(sizeof(conf_data));
+	conf_overrides* ov = (conf_overrides*)malloc(sizeof(conf_overrides));
+	if (!version || !ov) {
+		free(version);
+		free(ov);
+		node_release(root);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ov->refs		   = 1;
+	ov->base		   = conf_retain(base);
+	ov->root		   = root;
+	version->pairs	   = NULL;
+	version->count	   = count;
+	version->store	   = base->store;
+	version->overrides = ov;
+	return version;
+}
+
+/**
+ * @brief Hashes a key passed to conf_set() or conf_remove() and checks it.
+ *
+ * @return 0 if the key is valid, -1 with errno set to EINVAL otherwise.
+ */
+static int check_key(const conf_data* data, const char* key, uint64_t* hash)
+{
+	size_t len = 0;
+	if (data && data->store && key) *hash = conf_hash(key, &len);
+	if (len == 0 || len >= MAX_KEY_LEN) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+conf_data* conf_set(conf_data* data, const char* key, conf_type type,
+					conf_value value)
+{
+	uint64_t hash;
+	if (check_key(data, key, &hash) != 0) return NULL;
+	if (type == CONF_STRING && !value.str) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Store numbers as the loader does, so getters treat them alike */
+	if (type == CONF_INT) {
+		value.lval = value.ival;
+		type	   = CONF_LONG;
+	} else if (type == CONF_FLOAT) {
+		value.dval = value.fval;
+		type	   = CONF_DOUBLE;
+	}
+
+	conf_leaf* leaf = (conf_leaf*)calloc(1, sizeof(conf_leaf));
+	if (leaf && type == CONF_STRING) {
+		value.str = strdup(value.str);
+		if (!value.str) {
+			free(leaf);
+			leaf = NULL;
+		}
+	}
+	if (!leaf) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	leaf->refs		 = 1;
+	leaf->hash		 = hash;
+	leaf->pair.type	 = type;
+	leaf->pair.value = value;
+	strcpy(leaf->pair.key, key);
+
+	conf_type  old_type;
+	conf_value old_value;
+	int present = conf_lookup(data, key, hash, &old_type, &old_value) == 0;
+
+	conf_trie* root = trie_insert(data->overrides ? data->overrides->root : NULL,
+								  leaf, 0);
+	if (!root) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return version_new(data, root, data->count + !present);
+}
+
+conf_data* conf_remove(conf_data* data, const char* key)
+{
+	uint64_t hash;
+	if (check_key(data, key, &hash) != 0) return NULL;
+
+	conf_type  type;
+	conf_value value;
+	if (conf_lookup(data, key, hash, &type, &value) != 0) {
+		return conf_retain(data);
+	}
+
+	/* Keys of the loaded data are hidden by a tombstone */
+	conf_trie* root = data->overrides ? data->overrides->root : NULL;
+	if (conf_store_find_hash(data->store, key, hash) >= 0) {
+		conf_leaf* leaf = (conf_leaf*)calloc(1, sizeof(conf_leaf));
+		if (!leaf) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		leaf->refs	  = 1;
+		leaf->removed = 1;
+		leaf->hash	  = hash;
+		strcpy(leaf->pair.key, key);
+		root = trie_insert(root, leaf, 0);
+	} else if (trie_delete(root, key, hash, 0, &root) != 0) {
+		root = NULL;
+	} else if (!root) {
+		return conf_retain(version_base(data));
+	}
+	if (!root) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return version_new(data, root, data->count - 1);
+}
@@ -0,0 +1,138 @@
+/**
+ * @file conf_trie.h
+ * @brief Internal runtime overrides of the libconf library.
+ *
+ * Values set or removed at runtime are kept in a persistent hash array mapped
+ * trie on top of the loaded data, which itself is never modified. Each node
+ * of the trie consumes 5 bits of the key hash and holds a 32-bit bitmap of its
+ * occupied entries, followed by a packed array of child nodes and leaves.
+ * Updates copy only the nodes on the path to the changed leaf and share all
+ * others with the previous version, so an update allocates O(log n) memory and
+ * versions are immutable. Nodes and leaves are reference counted, as they are
+ * shared between versions that may be freed from different threads.
+ *
+ * Leaves of removed keys are kept as tombstones, so the key is hidden from the
+ * loaded data as well. Keys whose 64-bit hashes are equal end up in a
+ * collision node below the last level, which is searched linearly.
+ */
+
+#ifndef CONF_TRIE_H
+#define CONF_TRIE_H
+
+#include "conf_store.h"
+#include "libconf.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Leaf of the trie holding a key that was set or removed.
+ */
+typedef struct {
+	int		  refs;	   /**< Number of nodes referring to the leaf */
+	int		  removed; /**< Whether the key was removed */
+	uint64_t  hash;	   /**< Hash of the key as returned by conf_hash() */
+	conf_pair pair;	   /**< Key and value, string values are owned */
+} conf_leaf;
+
+/**
+ * @brief Node of the trie.
+ */
+typedef struct conf_trie {
+	int		 refs;		/**< Number of versions and nodes referring to it */
+	uint32_t bitmap;	/**< Occupied entries, by 5-bit chunk of the hash */
+	uint32_t leaves;	/**< Occupied entries that hold leaves */
+	void*	 entries[]; /**< Child nodes and leaves, in bitmap order */
+} conf_trie;
+
+/**
+ * @brief Runtime overrides of a version of configuration data.
+ */
+struct conf_overrides {
+	int		   refs; /**< References to the owning conf_data */
+	conf_data* base; /**< Loaded data the overrides apply to */
+	conf_trie* root; /**< Root of the trie */
+};
+
+/**
+ * @brief Finds the leaf of a key in a trie.
+ *
+ * @param[in] root Root of the trie, may be NULL.
+ * @param[in] key  Key string.
+ * @param[in] hash Hash of the key as returned by conf_hash().
+ *
+ * @return Pointer to the leaf, which may be a tombstone, or NULL if the key
+ * was neither set nor removed.
+ */
+const conf_leaf* conf_trie_find(const conf_trie* root, const char* key,
+								uint64_t hash);
+
+/**
+ * @brief Function called for each pair by conf_pairs_walk().
+ *
+ * @return 0 to continue, nonzero to stop the walk.
+ */
+typedef int (*conf_pair_fn)(const char* key, conf_type type, conf_value value,
+							void* ctx);
+
+/**
+ * @brief Calls a function for every pair of a version.
+ *
+ * Loaded pairs come first, in the order of the file, skipping those shadowed
+ * by a duplicate key or by an override. Overridden pairs follow in hash order,
+ * skipping removed keys. String values are passed in the @p str member.
+ *
+ * @param[in] data  Pointer to the conf_data struct.
+ * @param[in] visit Function to call.
+ * @param[in] ctx   Context to pass to @p visit.
+ *
+ * @return 0 if all pairs were visited, the nonzero result of @p visit
+ * otherwise.
+ */
+int conf_pairs_walk(const conf_data* data, conf_pair_fn visit, void* ctx);
+
+/**
+ * @brief Drops a reference to the overrides of a version.
+ *
+ * Frees the trie nodes that are no longer shared with other versions and drops
+ * the reference to the loaded data once the last reference is dropped.
+ *
+ * @param[in] overrides Pointer to the overrides.
+ *
+ * @return 1 if the last reference was dropped, 0 otherwise.
+ */
+int conf_overrides_release(conf_overrides* overrides);
+
+/**
+ * @brief Looks up the value of a key, taking runtime overrides into account.
+ *
+ * @param[in]  data  Pointer to the conf_data struct.
+ * @param[in]  key   Key string.
+ * @param[in]  hash  Hash of the key as returned by conf_hash().
+ * @param[out] type  Type of the value.
+ * @param[out] value Value, with string values in its @p str member.
+ *
+ * @return 0 if the key is present, -1 otherwise.
+ */
+static inline int conf_lookup(const conf_data* data, const char* key,
+							  uint64_t hash, conf_type* type, conf_value* value)
+{
+	if (data->overrides) {
+		const conf_leaf* leaf = conf_trie_find(data->overrides->root, key, hash);
+		if (leaf) {
+			if (leaf->removed) return -1;
+			*type  = leaf->pair.type;
+			*value = leaf->pair.value;
+			return 0;
+		}
+	}
+
+	const conf_store* store = data->store;
+	int				  i		= conf_store_find_hash(store, key, hash);
+	if (i < 0) return -1;
+	*type  = conf_store_type(store, i);
+	*value = store->values[i];
+	if (*type == CONF_STRING) value->str = conf_store_string(store, i);
+	return 0;
+}
+
+#endif /* CONF_TRIE_H */
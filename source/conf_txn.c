@@ -0,0 +1,159 @@
+/**
+ * @file conf_txn.c
+ * @brief Transactional updates of configuration handles for the libconf
+ * library.
+ *
+ * A transaction stages changes without touching the handle. Committing it
+ * applies all staged changes, in order, to the current snapshot while the lock
+ * of the handle is held, and publishes the result as a single snapshot. Readers
+ * therefore never see a partially applied transaction, waiters wake once, and
+ * the notification descriptor is signalled once. Changes published by others
+ * since the transaction began are kept, as the staged changes are replayed on
+ * top of them.
+ */
+
+#include "conf_handle.h"
+#include "libconf.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Change staged by a transaction.
+ */
+typedef struct {
+	char*	   key;		/**< Copy of the key */
+	int		   removed; /**< Whether the key is removed */
+	conf_type  type;	/**< Type of the value */
+	conf_value value;	/**< Value, string values are owned */
+} txn_op;
+
+/**
+ * @brief Transaction on a configuration handle.
+ */
+struct conf_txn {
+	conf_handle* handle; /**< Handle to publish to */
+	txn_op*		 ops;	 /**< Staged changes in order */
+	int			 count;	 /**< Number of staged changes */
+	int			 cap;	 /**< Capacity of the change array */
+};
+
+conf_txn* conf_txn_begin(conf_handle* handle)
+{
+	if (!handle) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	conf_txn* txn = (conf_txn*)calloc(1, sizeof(conf_txn));
+	if (txn) txn->handle = handle;
+	return txn;
+}
+
+void conf_txn_abort(conf_txn* txn)
+{
+	if (!txn) return;
+
+	for (int i = 0; i < txn->count; i++) {
+		if (!txn->ops[i].removed && txn->ops[i].type == CONF_STRING) {
+			free(txn->ops[i].value.str);
+		}
+		free(txn->ops[i].key);
+	}
+	free(txn->ops);
+	free(txn);
+}
+
+/**
+ * @brief Stages a change, copying its key and string value.
+ *
+ * @return 0 on success, -1 on failure with errno set.
+ */
+static int stage(conf_txn* txn, const char* key, int removed, conf_type type,
+				 conf_value value)
+{
+	/* Reject what conf_set() would reject, so commits fail only on memory */
+	size_t len = key ? strlen(key) : 0;
+	if (len == 0 || len >= MAX_KEY_LEN ||
+		(!removed && type == CONF_STRING && !value.str)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (txn->count == txn->cap) {
+		int		cap	  = txn->cap ? txn->cap * 2 : 8;
+		txn_op* grown = (txn_op*)realloc(txn->ops, cap * sizeof(txn_op));
+		if (!grown) return -1;
+		txn->ops = grown;
+		txn->cap = cap;
+	}
+
+	txn_op* op	= &txn->ops[txn->count];
+	op->key		= strdup(key);
+	op->removed = removed;
+	op->type	= type;
+	op->value	= value;
+	if (op->key && !removed && type == CONF_STRING) {
+		op->value.str = strdup(value.str);
+		if (!op->value.str) {
+			free(op->key);
+			op->key = NULL;
+		}
+	}
+	if (!op->key) {
+		errno = ENOMEM;
+		return -1;
+	}
+	txn->count++;
+	return 0;
+}
+
+int conf_txn_set(conf_txn* txn, const char* key, conf_type type,
+				 conf_value value)
+{
+	return stage(txn, key, 0, type, value);
+}
+
+int conf_txn_remove(conf_txn* txn, const char* key)
+{
+	conf_value none;
+	memset(&none, 0, sizeof(none));
+	return stage(txn, key, 1, CONF_STRING, none);
+}
+
+/**
+ * @brief Applies the staged changes of a transaction to the current snapshot.
+ *
+ * Intermediate versions are freed right away, only the nodes of the trie that
+ * the final version refers to are kept.
+ */
+static conf_data* apply(conf_data* current, void* ctx)
+{
+	const conf_txn* txn	 = (const conf_txn*)ctx;
+	conf_data*		data = conf_retain(current);
+	for (int i = 0; data && i < txn->count; i++) {
+		const txn_op* op   = &txn->ops[i];
+		conf_data*	  next = op->removed
+								 ? conf_remove(data, op->key)
+								 : conf_set(data, op->key, op->type, op->value);
+		conf_free(data);
+		data = next;
+	}
+	return data;
+}
+
+unsigned long conf_txn_commit(conf_txn* txn)
+{
+	if (!txn) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* Nothing to publish for an empty transaction */
+	unsigned long generation = txn->count
+								   ? conf_handle_update(txn->handle, apply, txn)
+								   : conf_handle_generation(txn->handle);
+	conf_txn_abort(txn);
+	return generation;
+}
@@ -9,130 +9,888 @@
  * float, double, string, and char.
  */
 
+#include "conf_cache.h"
+#include "conf_load.h"
+#include "conf_store.h"
+#include "conf_trie.h"
 #include "libconf.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>
 #include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
-conf_data* conf_load(const char* filename)
+/* Initial size of the buffer for files of unknown size */
+#define READ_CHUNK_SIZE 4096
+
+/**
+ * @brief Reads a whole file into a NUL-terminated buffer.
+ *
+ * @param[in]  fp   File to read.
+ * @param[out] size Number of bytes read.
+ *
+ * @return Pointer to the buffer on success, NULL on failure.
+ */
+static char* read_file(FILE* fp, size_t* size)
 {
-	FILE* fp = fopen(filename, "r");
-	if (!fp) {
-		perror("Failed to open file");
+	struct stat st;
+	size_t		cap = READ_CHUNK_SIZE;
+	if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+		// One spare byte, so reading a whole regular file hits its end
+		cap = (size_t)st.st_size + 2;
+	}
+
+	char* buf = (char*)malloc(cap);
+	if (!buf) return NULL;
+
+	// Read until the end of the file, growing the buffer if needed
+	size_t len = 0;
+	for (;;) {
+		len += fread(buf + len, 1, cap - len - 1, fp);
+		if (len < cap - 1) break;
+
+		char* grown = (char*)realloc(buf, cap * 2);
+		if (!grown) {
+			free(buf);
+			return NULL;
+		}
+		buf = grown;
+		cap *= 2;
+	}
+	if (ferror(fp)) {
+		free(buf);
 		return NULL;
 	}
 
-	// Allocate space for the conf_data struct and initialize it
-	conf_data* data = (conf_data*)malloc(sizeof(conf_data));
-	if (!data) {
-		fclose(fp);
-		perror("Failed to allocate memory");
+	buf[len] = '\0';
+	*size	 = len;
+	return buf;
+}
+
+/* C-style escape sequences and the characters they stand for */
+static const char escapes[]	  = "ntr0abfv\\\"'";
+static const char unescaped[] = "\n\t\r\0\a\b\f\v\\\"'";
+
+/**
+ * @brief State of the parser while it scans the loaded buffer.
+ */
+typedef struct {
+	conf_data*	data;				  /**< Configuration data being loaded */
+	int			flags;				  /**< Flags passed to conf_load_ex() */
+	conf_error* err;				  /**< Diagnostics, may be NULL */
+	char*		cursor;				  /**< Scan position in the buffer */
+	char*		end;				  /**< End of the NUL-terminated buffer */
+	int			line;				  /**< First physical line of the line */
+	int			next_line;			  /**< Physical line at the scan position */
+	char		section[MAX_KEY_LEN]; /**< Current INI section, folded */
+	size_t		section_len;		  /**< Length of the INI section */
+	int			skip_section;		  /**< Skip the keys of the INI section */
+	char		key[MAX_KEY_LEN];	  /**< INI key with its section, folded */
+	char*		unclosed[2];		  /**< No '"' or '\'' closes past these */
+} parser;
+
+/**
+ * @brief Records a malformed line.
+ *
+ * Only the first problem is recorded, later ones are counted. Nothing is
+ * allocated, so diagnostics cost nothing for well-formed files.
+ *
+ * @param[in] p      Pointer to the parser.
+ * @param[in] code   Error code of the problem.
+ * @param[in] line   Logical line containing the problem.
+ * @param[in] pos    Position of the problem in the line.
+ * @param[in] reason Description of the problem.
+ *
+ * @return The error code in strict mode, CONF_OK otherwise so the line is
+ * skipped.
+ */
+static conf_error_code parse_error(parser* p, conf_error_code code,
+								   const char* line, const char* pos,
+								   const char* reason)
+{
+	if (p->err) {
+		if (p->err->code == CONF_OK) {
+			p->err->code   = code;
+			p->err->line   = p->line;
+			p->err->column = (int)(pos - line) + 1;
+			p->err->reason = reason;
+			p->err->key	   = NULL;
+		}
+		p->err->problems++;
+	}
+	return (p->flags & CONF_STRICT) ? code : CONF_OK;
+}
+
+/**
+ * @brief Parses a double-quoted string in place.
+ *
+ * Strings without escape sequences are only terminated, strings with escape
+ * sequences are decoded into the same memory, which never grows.
+ *
+ * @param[in]  quote Pointer to the opening quote.
+ * @param[out] str   Start of the unquoted string.
+ * @param[out] len   Length of the unquoted string.
+ * @param[out] rest  Pointer behind the closing quote, or to the problem if
+ *                   the string is malformed.
+ *
+ * @return NULL on success, a description of the problem otherwise.
+ */
+static const char* parse_quoted(char* quote, char** str, size_t* len,
+								char** rest)
+{
+	char* src = quote + 1;
+
+	// Fast path: no escape sequences, terminate the string at the quote
+	char* stop = strpbrk(src, "\"\\");
+	*str	   = src;
+	if (!stop) {
+		*rest = quote;
+		return "unterminated quoted value";
+	}
+	if (*stop == '"') {
+		*stop = '\0';
+		*len  = stop - src;
+		*rest = stop + 1;
 		return NULL;
 	}
-	data->count = 0;
-	data->pairs = NULL;
 
-	// Read the file line by line
-	char   line[512];
-	char*  key	   = line;
-	size_t key_len = 0;
-	while (fgets(line, sizeof(line), fp)) {
-		// Ignore comments
-		if (line[0] == '#') {
+	// Decode the escape sequences in place
+	char* dst = stop;
+	src		  = stop;
+	while (*src != '"') {
+		if (*src == '\0') {
+			*rest = quote;
+			return "unterminated quoted value";
+		}
+		if (*src != '\\') {
+			*dst++ = *src++;
 			continue;
 		}
 
-		// Parse key-value pairs and set the length of the key
-		char* pos = strchr(line, '=');
-		if (!pos) {
+		// Simple escape sequences map to a single character
+		const char* esc = src[1] ? strchr(escapes, src[1]) : NULL;
+		if (esc) {
+			*dst++ = unescaped[esc - escapes];
+			src	  += 2;
 			continue;
 		}
-		key_len = pos - line;
 
-		// Allocate space for the new pair and copy the key
-		conf_pair* pair = (conf_pair*)malloc(sizeof(conf_pair));
-		if (!pair) {
-			fclose(fp);
-			conf_free(data);
-			perror("Failed to allocate memory");
-			return NULL;
+		// Hexadecimal escape sequences consist of exactly two digits
+		if (src[1] != 'x' || !isxdigit((unsigned char)src[2]) ||
+			!isxdigit((unsigned char)src[3])) {
+			*rest = src;
+			return "invalid escape sequence";
 		}
+		char hex[3] = {src[2], src[3], '\0'};
+		*dst++		= (char)strtol(hex, NULL, 16);
+		src		   += 4;
+	}
+
+	*dst  = '\0';
+	*len  = dst - *str;
+	*rest = src + 1;
+	return NULL;
+}
+
+/**
+ * @brief Parses a single-quoted dotenv string in place.
+ *
+ * Single-quoted strings are taken literally, without escape sequences, and
+ * end at the next single quote.
+ *
+ * @param[in]  quote Pointer to the opening quote.
+ * @param[out] str   Start of the unquoted string.
+ * @param[out] len   Length of the unquoted string.
+ * @param[out] rest  Pointer behind the closing quote, or to the opening quote
+ *                   if the string is unterminated.
+ *
+ * @return NULL on success, a description of the problem otherwise.
+ */
+static const char* parse_literal(char* quote, char** str, size_t* len,
+								 char** rest)
+{
+	char* stop = strchr(quote + 1, '\'');
+	*str	   = quote + 1;
+	if (!stop) {
+		*rest = quote;
+		return "unterminated quoted value";
+	}
+	*stop = '\0';
+	*len  = stop - *str;
+	*rest = stop + 1;
+	return NULL;
+}
+
+/**
+ * @brief States of the logical line scanner.
+ */
+typedef enum {
+	SCAN_KEY,		  /**< Before the first '=' */
+	SCAN_VALUE_START, /**< Whitespace after the first '=' */
+	SCAN_VALUE,		  /**< Unquoted value */
+	SCAN_QUOTED,	  /**< Inside a quoted value */
+	SCAN_LITERAL,	  /**< Inside a single-quoted dotenv value */
+} scan_state;
+
+/**
+ * @brief Returns whether a line continues behind the character at @p pos.
+ */
+static int is_continuation(const char* pos)
+{
+	return pos[0] == '\\' &&
+		   (pos[1] == '\n' || (pos[1] == '\r' && pos[2] == '\n'));
+}
+
+/**
+ * @brief Returns whether a quote closes a dotenv value behind @p pos.
+ *
+ * Escaped double quotes do not count, single-quoted values have no escapes.
+ */
+static int has_closing_quote(const char* pos, const char* end, char quote)
+{
+	for (; pos < end; pos++) {
+		if (*pos == quote) return 1;
+		if (quote == '"' && *pos == '\\' && pos + 1 < end) pos++;
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns whether a comment starts at @p src.
+ *
+ * @param[in] p    Pointer to the parser.
+ * @param[in] line Start of the logical line.
+ * @param[in] dst  End of the characters of the line kept so far.
+ * @param[in] src  Scan position.
+ */
+static int is_comment(const parser* p, const char* line, const char* dst,
+					  const char* src)
+{
+	int after_space = dst == line || isspace((unsigned char)dst[-1]);
+	if (*src == '#') return after_space;
+	if (*src != ';') return 0;
+	if (p->flags & CONF_INI) return after_space;
 
-		// Remove leading and trailing spaces from the key
-		while (isspace(*key)) {
-			key++;
-			key_len--;
+	// EnvironmentFile comments start with ';' only at the start of a line
+	if (!(p->flags & CONF_ENV)) return 0;
+	while (line < dst && isspace((unsigned char)*line)) {
+		line++;
+	}
+	return line == dst;
+}
+
+/**
+ * @brief Extracts the next logical line from the buffer in place.
+ *
+ * Comments starting with '#', or also ';' with CONF_INI, at the beginning of
+ * a line or after whitespace are cut off, unless they are inside a quoted
+ * value. With CONF_ENV, quoted values may span several lines; a quote that is
+ * never closed ends at its line, which then reports the unterminated quote.
+ * Lines ending in a backslash are joined with the next line, whose indentation
+ * is dropped, except inside single-quoted dotenv values. Both
+ * happen while moving the characters of the line forward over the removed
+ * ones, so the buffer is scanned once and never copied.
+ *
+ * @param[in] p Pointer to the parser, advanced behind the logical line.
+ *
+ * @return Pointer to the NUL-terminated logical line.
+ */
+static char* next_line(parser* p)
+{
+	char*	   line	 = p->cursor;
+	char*	   src	 = line;
+	char*	   dst	 = line;
+	scan_state state  = SCAN_KEY;
+	int		   env	  = (p->flags & CONF_ENV) != 0;
+	int		   closed = 0;
+
+	p->line = p->next_line;
+	while (src < p->end &&
+		   (*src != '\n' ||
+			(env && (state == SCAN_QUOTED || state == SCAN_LITERAL)))) {
+		// Join continuation lines, single quotes keep backslashes as they are
+		if (state != SCAN_LITERAL && is_continuation(src)) {
+			src += src[1] == '\n' ? 2 : 3;
+			while (*src == ' ' || *src == '\t') {
+				src++;
+			}
+			p->next_line++;
+			continue;
 		}
-		while (isspace(key[key_len - 1])) {
-			key_len--;
+
+		if (*src == '\n') {
+			// Line breaks inside quoted dotenv values are kept, unless the
+			// quote is never closed and would swallow the rest of the file
+			int literal = state == SCAN_LITERAL;
+			if (!closed) {
+				if ((p->unclosed[literal] && src >= p->unclosed[literal]) ||
+					!has_closing_quote(src, p->end, literal ? '\'' : '"')) {
+					p->unclosed[literal] = src;
+					break;
+				}
+				closed = 1;
+			}
+			p->next_line++;
+		} else if (state == SCAN_QUOTED) {
+			// Keep escape sequences, an escaped quote does not end the value
+			if (*src == '\\' && src[1] != '\n' && src[1] != '\0') {
+				*dst++ = *src++;
+			} else if (*src == '"') {
+				state = SCAN_VALUE;
+			}
+		} else if (state == SCAN_LITERAL) {
+			if (*src == '\'') {
+				state = SCAN_VALUE;
+			}
+		} else if (is_comment(p, line, dst, src)) {
+			// Cut off the comment up to the end of the line
+			src = (char*)memchr(src, '\n', p->end - src);
+			if (!src) {
+				src = p->end;
+			}
+			break;
+		} else if (state == SCAN_KEY && *src == '=') {
+			state = SCAN_VALUE_START;
+		} else if (state == SCAN_VALUE_START && *src == '"') {
+			state = SCAN_QUOTED;
+		} else if (state == SCAN_VALUE_START && env && *src == '\'') {
+			state = SCAN_LITERAL;
+		} else if (state == SCAN_VALUE_START &&
+				   !isspace((unsigned char)*src)) {
+			state = SCAN_VALUE;
 		}
+		*dst++ = *src++;
+	}
+
+	*dst	  = '\0';
+	p->cursor = src < p->end ? src + 1 : p->end;
+	p->next_line++;
+	return line;
+}
 
-		// Copy the key to the pair
-		strncpy(pair->key, key, key_len);
-		pair->key[key_len] = '\0';
+/**
+ * @brief Removes leading and trailing spaces from the key before @p stop.
+ *
+ * @param[in]  line Start of the line.
+ * @param[in]  stop End of the key, the separator following it.
+ * @param[out] key  Start of the trimmed key.
+ *
+ * @return Length of the trimmed key, which may exceed MAX_KEY_LEN - 1.
+ */
+static size_t parse_key(char* line, char* stop, char** key)
+{
+	char* start = line;
+	while (start < stop && isspace((unsigned char)*start)) {
+		start++;
+	}
+	size_t key_len = stop - start;
+	while (key_len > 0 && isspace((unsigned char)start[key_len - 1])) {
+		key_len--;
+	}
 
-		// Determine the type of the value
-		char*  end;
-		double dval = strtod(pos + 1, &end);
-		if (*end == '\n' || *end == '\0') {
-			// The value is an integer or a long
-			if ((long long)dval == dval) {
-				pair->type		 = CONF_LONG;
-				pair->value.lval = (long long)dval;
-			} else {
-				// The value is a float or a double
-				pair->type		 = CONF_DOUBLE;
-				pair->value.dval = dval;
-			}
+	*key = start;
+	return key_len;
+}
+
+/**
+ * @brief Checks a trimmed key, which must be shorter than MAX_KEY_LEN including
+ * the prefix of its INI section.
+ *
+ * Lines with overlong keys are skipped rather than stored under a truncated
+ * key, so keys sharing a long prefix never alias.
+ *
+ * @param[in]     p       Pointer to the parser.
+ * @param[in]     line    Logical line containing the key.
+ * @param[in]     key     Start of the trimmed key.
+ * @param[in,out] key_len Length of the key, set to 0 if the line is skipped.
+ *
+ * @return CONF_OK if the key is valid or the line is skipped, an error code
+ * otherwise.
+ */
+static conf_error_code check_key(parser* p, const char* line, const char* key,
+								 size_t* key_len)
+{
+	// Keys of a skipped section were reported with its header
+	if (p->skip_section) {
+		*key_len = 0;
+		return CONF_OK;
+	}
+	if (*key_len == 0) {
+		return parse_error(p, CONF_ERR_KEY, line, key, "empty key");
+	}
+	size_t prefix = p->section_len ? p->section_len + 1 : 0;
+	if (prefix + *key_len >= MAX_KEY_LEN) {
+		*key_len = 0;
+		return parse_error(p, CONF_ERR_KEY, line, key, "key too long");
+	}
+	return CONF_OK;
+}
+
+/**
+ * @brief Copies a checked INI key behind its section and folds its case.
+ *
+ * Keys are stored and hashed in lower case once at load time, so lookups with
+ * lower case keys stay a single probe.
+ *
+ * @param[in]     p       Pointer to the parser.
+ * @param[in,out] key     Start of the key, set to the copy in the parser.
+ * @param[in,out] key_len Length of the key, set to that of the copy.
+ */
+static void ini_key(parser* p, char** key, size_t* key_len)
+{
+	size_t len = 0;
+	if (p->section_len) {
+		memcpy(p->key, p->section, p->section_len);
+		p->key[p->section_len] = '.';
+		len					   = p->section_len + 1;
+	}
+	for (size_t i = 0; i < *key_len; i++) {
+		p->key[len++] = (char)tolower((unsigned char)(*key)[i]);
+	}
+
+	*key	 = p->key;
+	*key_len = len;
+}
+
+/**
+ * @brief Parses an INI section header of the form '[section]'.
+ *
+ * The folded name prefixes the keys of the following lines, until the next
+ * header. An empty name returns to keys without a prefix. A name too long to
+ * prefix any key is reported, and the keys up to the next header are skipped.
+ *
+ * @param[in] p    Pointer to the parser.
+ * @param[in] line NUL-terminated logical line.
+ * @param[in] open Pointer to the '[' in the line.
+ *
+ * @return CONF_OK on success or if the line is skipped, an error code
+ * otherwise.
+ */
+static conf_error_code parse_section(parser* p, char* line, char* open)
+{
+	char* close = strchr(open, ']');
+	if (!close) {
+		return parse_error(p, CONF_ERR_SYNTAX, line, open, "missing ']'");
+	}
+	char* rest = close + 1;
+	while (isspace((unsigned char)*rest)) {
+		rest++;
+	}
+	if (*rest != '\0') {
+		return parse_error(p, CONF_ERR_SYNTAX, line, rest,
+						   "unexpected characters after section");
+	}
+
+	// Leave room for the dot and at least one character of a key
+	// Overlong sections are skipped with their keys, so that sections sharing
+	// a long prefix never alias
+	char*  name;
+	size_t len		= parse_key(open + 1, close, &name);
+	p->skip_section = len > MAX_KEY_LEN - 3;
+	if (p->skip_section) {
+		p->section_len = 0;
+		return parse_error(p, CONF_ERR_KEY, line, name, "section too long");
+	}
+	for (size_t i = 0; i < len; i++) {
+		p->section[i] = (char)tolower((unsigned char)name[i]);
+	}
+	p->section_len = len;
+	return CONF_OK;
+}
+
+/**
+ * @brief Maps the result of adding a pair to the storage to an error code,
+ * and records the line of the pair if requested.
+ */
+static conf_error_code added(parser* p, int rc)
+{
+	conf_store* store = p->data->store;
+	if (rc != 0) return CONF_ERR_MEMORY;
+	if ((p->flags & CONF_LINES) &&
+		conf_store_set_line(store, store->count - 1, p->line) != 0) {
+		return CONF_ERR_MEMORY;
+	}
+	p->data->count++;
+	return CONF_OK;
+}
+
+/**
+ * @brief Parses a heredoc value and adds its key-value pair to the storage.
+ *
+ * The value consists of the lines following the header up to a line holding
+ * only the terminator. It is kept in place as a single span of the loaded
+ * buffer, without comment handling or line joining.
+ *
+ * @param[in] p      Pointer to the parser, advanced behind the terminator.
+ * @param[in] line   NUL-terminated header line of the form 'key <<TAG'.
+ * @param[in] marker Pointer to the '<<' in the header line.
+ *
+ * @return CONF_OK on success or if the heredoc is skipped, an error code
+ * otherwise.
+ */
+static conf_error_code parse_heredoc(parser* p, char* line, char* marker)
+{
+	char*			key;
+	size_t			key_len = parse_key(line, marker, &key);
+	conf_error_code rc		= check_key(p, line, key, &key_len);
+	if (rc != CONF_OK || key_len == 0) return rc;
+	if (p->flags & CONF_INI) ini_key(p, &key, &key_len);
+
+	// The terminator is the word following '<<'
+	char* tag = marker + 2;
+	while (*tag == ' ' || *tag == '\t') {
+		tag++;
+	}
+	size_t tag_len = 0;
+	while (tag[tag_len] && !isspace((unsigned char)tag[tag_len])) {
+		tag_len++;
+	}
+	if (tag_len == 0) {
+		return parse_error(p, CONF_ERR_HEREDOC, line, tag,
+						   "missing heredoc terminator");
+	}
+
+	// Find the terminator line, the value ends at the line break before it
+	char* body = p->cursor;
+	int	  lines = 0;
+	for (char* pos = body; pos < p->end; lines++) {
+		char* eol = (char*)memchr(pos, '\n', p->end - pos);
+		if (!eol) {
+			eol = p->end;
+		}
+
+		char* stop = eol;
+		while (stop > pos && isspace((unsigned char)stop[-1])) {
+			stop--;
+		}
+		if ((size_t)(stop - pos) == tag_len &&
+			memcmp(pos, tag, tag_len) == 0) {
+			char* value_end = pos > body ? pos - 1 : pos;
+			*value_end		= '\0';
+			p->cursor		= eol < p->end ? eol + 1 : p->end;
+			p->next_line   += lines + 1;
+
+			return added(p, conf_store_add_span(p->data->store, key, key_len,
+												body, value_end - body));
+		}
+		pos = eol + 1;
+	}
+
+	// Without a terminator, only the header line is skipped
+	return parse_error(p, CONF_ERR_HEREDOC, line, marker,
+					   "unterminated heredoc");
+}
+
+/**
+ * @brief Parses a single line and adds its key-value pair to the storage.
+ *
+ * @param[in] p    Pointer to the parser.
+ * @param[in] line NUL-terminated logical line inside the loaded buffer.
+ *
+ * @return CONF_OK on success or if the line is skipped, an error code
+ * otherwise.
+ */
+static conf_error_code parse_line(parser* p, char* line)
+{
+	conf_store* store = p->data->store;
+
+	// INI section headers start with '['
+	if (p->flags & CONF_INI) {
+		char* open = line;
+		while (isspace((unsigned char)*open)) {
+			open++;
+		}
+		if (*open == '[') {
+			return parse_section(p, line, open);
+		}
+	}
+
+	// dotenv keys may be preceded by 'export', which is dropped
+	char* start = line;
+	if (p->flags & CONF_ENV) {
+		while (isspace((unsigned char)*start)) {
+			start++;
+		}
+		if (strncmp(start, "export", 6) == 0 &&
+			(start[6] == ' ' || start[6] == '\t')) {
+			start += 7;
+			if (!strchr(start, '=')) return CONF_OK;
 		} else {
-			// The value is a string, remove starting and trailing
-			pair->type = CONF_STRING;
-			size_t len =
-				strlen(pos + 1) > MAX_VAL_LEN ? MAX_VAL_LEN : strlen(pos + 1);
-
-			pair->value.str = (char*)malloc(len);
-			if (!pair->value.str) {
-				fclose(fp);
-				conf_free(data);
-				perror("Failed to allocate memory");
-				return NULL;
-			}
+			start = line;
+		}
+	}
 
-			// remove leading spaces and '='
-			while (isspace(*pos) || *pos == '=') {
-				pos++;
-				len--;
-			}
+	// Parse key-value pairs, or heredoc values if there is no '='
+	char* pos = strchr(line, '=');
+	if (!pos) {
+		char* marker = strstr(line, "<<");
+		if (marker) {
+			return parse_heredoc(p, line, marker);
+		}
 
-			// remove trailing spaces
-			while (isspace(pos[len - 1])) {
-				len--;
-			}
+		// Lines with nothing but whitespace are fine
+		char* rest = line;
+		while (isspace((unsigned char)*rest)) {
+			rest++;
+		}
+		return *rest ? parse_error(p, CONF_ERR_SYNTAX, line, rest,
+								   "missing '='")
+					 : CONF_OK;
+	}
+
+	// Remove leading and trailing spaces from the key
+	char*			key;
+	size_t			key_len = parse_key(start, pos, &key);
+	conf_error_code rc		= check_key(p, line, key, &key_len);
+	if (rc != CONF_OK || key_len == 0) return rc;
+	if (p->flags & CONF_INI) ini_key(p, &key, &key_len);
 
-			strncpy(pair->value.str, pos, len);
-			pair->value.str[len] = '\0';
+	// Remove leading spaces from the value
+	char* val = pos + 1;
+	while (isspace((unsigned char)*val)) {
+		val++;
+	}
+
+	// Quoted values are always strings and refer to the loaded buffer; dotenv
+	// values may also be single-quoted, without escape sequences
+	int literal = (p->flags & CONF_ENV) && *val == '\'';
+	if (*val == '"' || literal) {
+		size_t		len;
+		char*		rest;
+		const char* reason = literal ? parse_literal(val, &val, &len, &rest)
+									 : parse_quoted(val, &val, &len, &rest);
+		if (reason) {
+			return parse_error(p, CONF_ERR_QUOTE, line, rest, reason);
+		}
+		while (isspace((unsigned char)*rest)) {
+			rest++;
 		}
+		if (*rest != '\0') {
+			return parse_error(p, CONF_ERR_SYNTAX, line, rest,
+							   "unexpected characters after quoted value");
+		}
+		return added(p, conf_store_add_span(store, key, key_len, val, len));
+	}
+
+	// Empty dotenv values are empty strings rather than zero
+	if ((p->flags & CONF_ENV) && *val == '\0') {
+		return added(p, conf_store_add_string(store, key, key_len, val, 0));
+	}
+
+	// Determine the type of the value and add the pair to the storage
+	char*  num_end;
+	double dval = strtod(pos + 1, &num_end);
+	while (isspace((unsigned char)*num_end)) {
+		num_end++;
+	}
+	if (*num_end == '\0') {
+		conf_value value;
+		if ((long long)dval == dval) {
+			// The value is an integer or a long
+			value.lval = (long long)dval;
+			return added(p,
+						 conf_store_add(store, key, key_len, CONF_LONG, value));
+		}
+
+		// The value is a float or a double
+		value.dval = dval;
+		return added(p,
+					 conf_store_add(store, key, key_len, CONF_DOUBLE, value));
+	}
+
+	// The value is a string, remove trailing spaces
+	size_t len = strlen(val);
+	while (len > 0 && isspace((unsigned char)val[len - 1])) {
+		len--;
+	}
+	if (len > MAX_VAL_LEN) {
+		len = MAX_VAL_LEN;
+	}
+
+	// Short strings are stored inline, longer ones in the string pool
+	return added(p, conf_store_add_string(store, key, key_len, val, len));
+}
+
+/**
+ * @brief Fills in the error info, if requested.
+ */
+static void set_error(conf_error* err, conf_error_code code,
+					  const char* reason)
+{
+	if (!err) return;
+	err->code	= code;
+	err->line	= 0;
+	err->column = 0;
+	err->reason = reason;
+	err->key	= NULL;
+}
+
+conf_data* conf_load_buffer(char* buf, size_t size, int flags,
+							conf_error* err)
+{
+	set_error(err, CONF_OK, NULL);
+	if (err) err->problems = 0;
 
-		// Add the new pair to the array
-		conf_pair* new_pairs = (conf_pair*)realloc(
-			data->pairs, sizeof(conf_pair) * (data->count + 1));
-		if (!new_pairs) {
+	// Allocate space for the conf_data struct and its storage
+	conf_data* data = (conf_data*)malloc(sizeof(conf_data));
+	if (!data) {
+		free(buf);
+		set_error(err, CONF_ERR_MEMORY, "Failed to allocate memory");
+		return NULL;
+	}
+	data->count		= 0;
+	data->pairs		= NULL;
+	data->overrides = NULL;
+	data->store		= conf_store_new();
+	if (!data->store) {
+		free(buf);
+		conf_free(data);
+		set_error(err, CONF_ERR_MEMORY, "Failed to allocate memory");
+		return NULL;
+	}
+	data->store->source		 = buf;
+	data->store->source_size = size;
+
+	// Parse the buffer in a single pass over its logical lines or JSON tokens
+	conf_error_code rc = CONF_OK;
+	if (flags & CONF_JSON) {
+		rc = conf_json_parse(data, buf, size, flags, err);
+	} else {
+		parser p = {data, flags, err, buf, buf + size, 1, 1, {0}, 0, 0, {0},
+					{NULL, NULL}};
+		while (rc == CONF_OK && p.cursor < p.end) {
+			char* line = next_line(&p);
+			rc		   = parse_line(&p, line);
+		}
+	}
+	if (rc == CONF_ERR_MEMORY) {
+		conf_free(data);
+		set_error(err, CONF_ERR_MEMORY, "Failed to allocate memory");
+		return NULL;
+	}
+	if (rc != CONF_OK) {
+		conf_free(data);
+		return NULL;
+	}
+
+	// Build the filter used to reject lookups of absent keys
+	if (conf_store_finish(data->store) != 0) {
+		conf_free(data);
+		set_error(err, CONF_ERR_MEMORY, "Failed to allocate memory");
+		return NULL;
+	}
+	return data;
+}
+
+conf_data* conf_load_image(void* image, size_t size, size_t offset)
+{
+	conf_data* data = (conf_data*)malloc(sizeof(conf_data));
+	if (!data) return NULL;
+
+	data->pairs		= NULL;
+	data->overrides = NULL;
+	data->store		= conf_store_map(image, size, offset);
+	if (!data->store) {
+		free(data);
+		return NULL;
+	}
+	data->count = data->store->count;
+	return data;
+}
+
+/**
+ * @brief Loads a configuration file without its override journal.
+ */
+conf_data* conf_load_file(const char* filename, char* buf, size_t size,
+						  const struct stat* st, int flags, conf_error* err)
+{
+	// Map the parsed data from the cache if it is still valid; cache files do
+	// not record the dialect or lines, so only plain Key=Value files are cached
+	char	   cache_dir[PATH_MAX];
+	conf_data* data	  = NULL;
+	int		   cached = !(flags & (CONF_JSON | CONF_INI | CONF_ENV)) &&
+					!(flags & CONF_LINES) &&
+					conf_cache_dir(cache_dir, sizeof(cache_dir)) == 0;
+	if (cached) data = conf_cache_load(cache_dir, filename);
+	if (data) {
+		free(buf);
+		set_error(err, CONF_OK, NULL);
+		if (err) err->problems = 0;
+	} else {
+		// Read the whole file unless the caller already did, quoted values
+		// are kept in place
+		struct stat file_st;
+		if (!buf) {
+			FILE* fp = fopen(filename, "r");
+			if (!fp) {
+				set_error(err, CONF_ERR_IO, "Failed to open file");
+				if (err) err->problems = 0;
+				return NULL;
+			}
+			st	= fstat(fileno(fp), &file_st) == 0 ? &file_st : NULL;
+			buf = read_file(fp, &size);
 			fclose(fp);
-			conf_free(data);
-			return NULL;
+			if (!buf) {
+				set_error(err, CONF_ERR_IO, "Failed to read file");
+				if (err) err->problems = 0;
+				return NULL;
+			}
+		}
+
+		// Hash the contents before parsing changes them in place
+		conf_error local;
+		uint64_t   content = 0;
+		cached			   = cached && st;
+		if (cached) content = conf_hash_bytes(buf, size);
+		if (!err) err = &local;
+
+		// Only files without malformed lines are cached
+		data = conf_load_buffer(buf, size, flags, err);
+		if (!data) return NULL;
+		if (cached && err->problems == 0) {
+			conf_cache_save(cache_dir, filename, st, content, data);
 		}
-		data->pairs				 = new_pairs;
-		data->pairs[data->count] = *pair;
-		data->count++;
-		free(pair);
 	}
 
-	fclose(fp);
+	// Apply the durable overrides on top of the file
+	if (conf_journal_replay(filename, &data) != 0) {
+		int memory = errno == ENOMEM;
+		conf_free(data);
+		set_error(err, memory ? CONF_ERR_MEMORY : CONF_ERR_IO,
+				  memory ? "Failed to allocate memory"
+						 : "Failed to read override journal");
+		return NULL;
+	}
+	return data;
+}
+
+conf_data* conf_load_ex(const char* filename, int flags, conf_error* err)
+{
+	return conf_load_file(filename, NULL, 0, NULL, flags, err);
+}
+
+conf_data* conf_load(const char* filename)
+{
+	conf_error err;
+	conf_data* data = conf_load_ex(filename, 0, &err);
+	if (!data) {
+		perror(err.reason);
+	}
+	return data;
+}
+
+conf_data* conf_retain(conf_data* data)
+{
+	if (data && data->overrides) {
+		__atomic_add_fetch(&data->overrides->refs, 1, __ATOMIC_RELAXED);
+	} else if (data && data->store) {
+		__atomic_add_fetch(&data->store->refs, 1, __ATOMIC_RELAXED);
+	}
 	return data;
 }
 
@@ -140,45 +898,102 @@ void conf_free(conf_data* data)
 {
 	if (!data) return;
 
-	/* Iterate through all config pairs and free them*/
-	for (int i = 0; i < data->count; i++) {
-		if (data->pairs[i].type == CONF_STRING) {
-			free(data->pairs[i].value.str);
-		}
+	/* Versions with overrides share the storage of the loaded data */
+	if (data->overrides) {
+		if (conf_overrides_release(data->overrides)) free(data);
+		return;
+	}
+
+	/* Only the last reference frees the data */
+	if (data->store &&
+		__atomic_sub_fetch(&data->store->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
 	}
 
-	/* Free the array of pairs and the conf_data struct */
+	/* The materialized pairs share their strings with the storage */
 	free(data->pairs);
+	conf_store_free(data->store);
 	free(data);
 }
 
-const conf_pair* conf_get_pair(const conf_data* data, const char* key)
+/**
+ * @brief Looks up the type and value of the pair with the given key.
+ *
+ * @return 0 if the key is present, -1 otherwise.
+ */
+static int conf_find(const conf_data* data, const char* key, conf_type* type,
+					 conf_value* value)
 {
-	if (!data || !key || !data->pairs) return NULL;
+	if (!data || !key || !data->store) return -1;
+	return conf_lookup(data, key, conf_hash(key, NULL), type, value);
+}
+
+/**
+ * @brief Materializes the array of conf_pair structs from the storage.
+ *
+ * The array is published with a compare-and-swap, so concurrent readers of the
+ * same conf_data struct agree on a single view.
+ */
+static conf_pair* conf_materialize(conf_data* data)
+{
+	conf_pair* pairs = __atomic_load_n(&data->pairs, __ATOMIC_ACQUIRE);
+	if (pairs || data->count == 0) return pairs;
+
+	conf_pair* view = (conf_pair*)malloc(sizeof(conf_pair) * data->count);
+	if (!view) return NULL;
 
-	/* Iterate through all pairs and return the pair w/ correct key */
+	const conf_store* store = data->store;
 	for (int i = 0; i < data->count; i++) {
-		if (strcmp(data->pairs[i].key, key) == 0) {
-			return &data->pairs[i];
+		strncpy(view[i].key, conf_store_key(store, i), MAX_KEY_LEN - 1);
+		view[i].key[MAX_KEY_LEN - 1] = '\0';
+		view[i].type				 = conf_store_type(store, i);
+		view[i].value				 = store->values[i];
+		if (view[i].type == CONF_STRING) {
+			view[i].value.str = conf_store_string(store, i);
 		}
 	}
 
-	/* No pair with the given key was found */
-	return NULL;
+	/* Another thread may have published its view in the meantime */
+	if (!__atomic_compare_exchange_n(&data->pairs, &pairs, view, 0,
+									 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(view);
+		return pairs;
+	}
+	return view;
+}
+
+const conf_pair* conf_get_pair(const conf_data* data, const char* key)
+{
+	if (!data || !key || !data->store) return NULL;
+
+	/* Overridden keys have a pair of their own */
+	if (data->overrides) {
+		const conf_leaf* leaf = conf_trie_find(data->overrides->root, key,
+											   conf_hash(key, NULL));
+		if (leaf) return leaf->removed ? NULL : &leaf->pair;
+		data = data->overrides->base;
+	}
+
+	int i = conf_store_find(data->store, key);
+	if (i < 0) return NULL;
+
+	conf_pair* pairs = conf_materialize((conf_data*)data);
+	return pairs ? &pairs[i] : NULL;
 }
 
 int conf_get_int(const conf_data* data, const char* key, int default_value)
 {
-	const conf_pair* pair = conf_get_pair(data, key);
+	conf_type  type;
+	conf_value value;
 
-	if (!pair) return default_value;
+	if (conf_find(data, key, &type, &value) < 0) return default_value;
 
 	/* Check the correct value type */
-	switch (pair->type) {
+	switch (type) {
 	case CONF_INT:
-		return pair->value.ival;
+		return value.ival;
 	case CONF_LONG:
-		return (int)pair->value.lval;
+		return (int)value.lval;
 	default:
 		return default_value;
 	}
@@ -186,23 +1001,27 @@ int conf_get_int(const conf_data* data, const char* key, int default_value)
 
 long conf_get_long(const conf_data* data, const char* key, long default_value)
 {
-	const conf_pair* pair = conf_get_pair(data, key);
-	return (pair && pair->type == CONF_LONG) ? pair->value.lval : default_value;
+	conf_type  type;
+	conf_value value;
+	return (conf_find(data, key, &type, &value) == 0 && type == CONF_LONG)
+			   ? value.lval
+			   : default_value;
 }
 
 float conf_get_float(const conf_data* data, const char* key,
 					 float default_value)
 {
-	const conf_pair* pair = conf_get_pair(data, key);
+	conf_type  type;
+	conf_value value;
 
-	if (!pair) return default_value;
+	if (conf_find(data, key, &type, &value) < 0) return default_value;
 
 	/* Check the correct value type */
-	switch (pair->type) {
+	switch (type) {
 	case CONF_FLOAT:
-		return (float)pair->value.fval;
+		return value.fval;
 	case CONF_DOUBLE:
-		return (float)pair->value.dval;
+		return (float)value.dval;
 	default:
 		return default_value;
 	}
@@ -211,15 +1030,42 @@ float conf_get_float(const conf_data* data, const char* key,
 double conf_get_double(const conf_data* data, const char* key,
 					   double default_value)
 {
-	const conf_pair* pair = conf_get_pair(data, key);
-	return (pair && pair->type == CONF_DOUBLE) ? pair->value.dval
-											   : default_value;
+	conf_type  type;
+	conf_value value;
+	return (conf_find(data, key, &type, &value) == 0 && type == CONF_DOUBLE)
+			   ? value.dval
+			   : default_value;
 }
 
 const char* conf_get_string(const conf_data* data, const char* key,
 							const char* default_value)
 {
-	const conf_pair* pair = conf_get_pair(data, key);
-	return (pair && pair->type == CONF_STRING) ? pair->value.str
-											   : default_value;
+	conf_type  type;
+	conf_value value;
+	return (conf_find(data, key, &type, &value) == 0 && type == CONF_STRING)
+			   ? value.str
+			   : default_value;
+}
+
+char conf_get_char(const conf_data* data, const char* key, char default_value)
+{
+	conf_type  type;
+	conf_value value;
+	return (conf_find(data, key, &type, &value) == 0 && type == CONF_CHAR)
+			   ? value.cval
+			   : default_value;
+}
+
+void conf_get_stats(const conf_data* data, conf_stats* stats)
+{
+	if (!stats) return;
+	memset(stats, 0, sizeof(*stats));
+	if (!data || !data->store) return;
+
+	conf_store_stats(data->store, stats);
+	stats->pairs		= data->count;
+	stats->total_bytes += sizeof(conf_data);
+	if (data->pairs) {
+		stats->total_bytes += sizeof(conf_pair) * data->count;
+	}
 }
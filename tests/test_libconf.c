@@ -14,11 +14,16 @@
 // be included before cmocka.h
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <setjmp.h>
+#include <signal.h>
 #include <cmocka.h>
+#include <dirent.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -26,8 +31,20 @@
 #include <unistd.h>
 // clang-format on
 
-/* Configuration file path */
+/* Configuration file paths */
 #define CONF_PATH "test.conf"
+#define MANY_CONF_PATH "test_many.conf"
+#define SHARED_CONF_PATH "test_shared.conf"
+#define ERROR_CONF_PATH "test_error.conf"
+#define SCHEMA_PATH "test_schema.conf"
+#define BATCH_CONF_PATH "test_batch_%d.conf"
+#define CACHE_CONF_PATH "test_cache.conf"
+#define JSON_PATH "test.json"
+#define INI_PATH "test.ini"
+#define ENV_PATH "test.env"
+#define JOURNAL_CONF_PATH "test_journal.conf"
+#define JOURNAL_PATH JOURNAL_CONF_PATH ".journal"
+#define CACHE_DIR_TEMPLATE "test_cache_XXXXXX"
 
 /* Key definitions */
 #define S_KEY "string_key"
@@ -38,6 +55,20 @@
 #define S_KEY_WS_IN_VALUE "string_key_ws_in_value"
 #define S_KEY_WS_IN_KEY_BEFORE "string_key_ws_in_key_before"
 #define S_KEY_WS_IN_KEY_AFTER "string_key_ws_in_key_after"
+#define S_KEY_SHORT "short_string_key"
+#define S_KEY_LONG "long_string_key"
+#define Q_KEY "quoted_key"
+#define Q_KEY_NUMBER "quoted_number_key"
+#define Q_KEY_ESCAPED "quoted_escaped_key"
+#define Q_KEY_UNTERMINATED "quoted_unterminated_key"
+#define C_KEY_STRING "comment_string_key"
+#define C_KEY_INT "comment_int_key"
+#define C_KEY_QUOTED "comment_quoted_key"
+#define C_KEY_HASH "comment_hash_key"
+#define C_KEY_CONTINUED "continued_key"
+#define H_KEY "heredoc_key"
+#define H_KEY_EMPTY "heredoc_empty_key"
+#define H_KEY_AFTER "heredoc_after_key"
 
 /* Value definitions */
 #define F_VALUE 3.14159
@@ -45,9 +76,19 @@
 #define I_VALUE 42
 #define L_VALUE 3000000000
 #define S_VALUE "string value"
+#define S_VALUE_SHORT "en"
+#define S_VALUE_LONG                                                           \
+	"a string value that is too long to be stored inline in the value slot"
+
+#define Q_VALUE "  # not a comment = "
+#define Q_VALUE_ESCAPED "tab\t\"quoted\"\nA\\"
+
+#define H_VALUE "#!/bin/sh\n# not a comment \\\n\techo \"key=value\""
 
 /* Various settings */
 #define FLOAT_PRECISION 1e-6
+#define MANY_KEYS 1000
+#define BATCH_FILES 100
 
 /**
  * @brief Setup function for the tests. Creates a configuration file.
@@ -68,6 +109,21 @@ static void setup(void)
 	fprintf(conf, "%s= %s  \n", S_KEY_WS_IN_VALUE, S_VALUE);
 	fprintf(conf, "%s =%s  \n", S_KEY_WS_IN_KEY_AFTER, S_VALUE);
 	fprintf(conf, " %s=%s  \n", S_KEY_WS_IN_KEY_BEFORE, S_VALUE);
+	fprintf(conf, "%s=%s\n", S_KEY_SHORT, S_VALUE_SHORT);
+	fprintf(conf, "%s=%s\n", S_KEY_LONG, S_VALUE_LONG);
+	fprintf(conf, "%s = \"%s\"  \n", Q_KEY, Q_VALUE);
+	fprintf(conf, "%s=\"%d\"\n", Q_KEY_NUMBER, I_VALUE);
+	fprintf(conf, "%s=\"tab\\t\\\"quoted\\\"\\n\\x41\\\\\"\n", Q_KEY_ESCAPED);
+	fprintf(conf, "%s=\"%s\n", Q_KEY_UNTERMINATED, S_VALUE);
+	fprintf(conf, "%s=%s # comment\n", C_KEY_STRING, S_VALUE);
+	fprintf(conf, "%s=%d\t# comment\n", C_KEY_INT, I_VALUE);
+	fprintf(conf, "%s=\"%s\" # comment\n", C_KEY_QUOTED, Q_VALUE);
+	fprintf(conf, "%s=a#b\n", C_KEY_HASH);
+	fprintf(conf, "   # %s=commented out\n", S_KEY);
+	fprintf(conf, "%s=string \\\n    value # comment\n", C_KEY_CONTINUED);
+	fprintf(conf, "%s <<EOF\n%s\nEOF\n", H_KEY, H_VALUE);
+	fprintf(conf, "%s <<END\nEND\n", H_KEY_EMPTY);
+	fprintf(conf, "%s=%d\n", H_KEY_AFTER, I_VALUE);
 	fclose(conf);
 }
 
@@ -89,6 +145,387 @@ static void test_conf_load_invalid(void** state)
 	assert_null(conf);
 }
 
+static void test_conf_load_ex_invalid(void** state)
+{
+	(void)state; /* unused */
+
+	conf_error err;
+	conf_data* conf = conf_load_ex("invalid.conf", 0, &err);
+	assert_null(conf);
+	assert_int_equal(err.code, CONF_ERR_IO);
+	assert_non_null(err.reason);
+}
+
+/**
+ * @brief Writes a configuration file with two malformed lines.
+ */
+static void write_error_conf(void)
+{
+	FILE* fp = fopen(ERROR_CONF_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "# comment\n");
+	fprintf(fp, "%s=%d\n", I_KEY, I_VALUE);
+	fprintf(fp, "%s=string \\\n  value\n", S_KEY);
+	fprintf(fp, "\n");
+	fprintf(fp, "  missing separator\n");
+	fprintf(fp, "%s=\"unterminated\n", Q_KEY);
+	fclose(fp);
+}
+
+static void test_conf_load_ex_diagnostics(void** state)
+{
+	(void)state; /* unused */
+
+	write_error_conf();
+
+	/* Malformed lines are skipped, the first one is reported */
+	conf_error err;
+	conf_data* conf = conf_load_ex(ERROR_CONF_PATH, 0, &err);
+	assert_non_null(conf);
+	assert_int_equal(conf_get_int(conf, I_KEY, -1), I_VALUE);
+	assert_string_equal(conf_get_string(conf, S_KEY, "failed"), S_VALUE);
+	assert_int_equal(err.code, CONF_ERR_SYNTAX);
+	assert_int_equal(err.line, 6);
+	assert_int_equal(err.column, 3);
+	assert_int_equal(err.problems, 2);
+	conf_free(conf);
+
+	remove(ERROR_CONF_PATH);
+}
+
+static void test_conf_load_ex_strict(void** state)
+{
+	(void)state; /* unused */
+
+	write_error_conf();
+
+	/* The first malformed line fails the load */
+	conf_error err;
+	conf_data* conf = conf_load_ex(ERROR_CONF_PATH, CONF_STRICT, &err);
+	assert_null(conf);
+	assert_int_equal(err.code, CONF_ERR_SYNTAX);
+	assert_int_equal(err.line, 6);
+	assert_int_equal(err.column, 3);
+
+	remove(ERROR_CONF_PATH);
+}
+
+static void test_conf_load_long_keys(void** state)
+{
+	(void)state; /* unused */
+
+	/* Two overlong keys that only differ beyond MAX_KEY_LEN characters */
+	char key[MAX_KEY_LEN + 2];
+	memset(key, 'k', sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	FILE* fp			 = fopen(ERROR_CONF_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "%sa=1\n%sb=2\n", key, key);
+	key[MAX_KEY_LEN - 1] = '\0';
+	fprintf(fp, "%s=3\n", key);
+	fclose(fp);
+
+	/* Their lines are skipped, keys just short enough are kept */
+	conf_error err;
+	conf_data* conf = conf_load_ex(ERROR_CONF_PATH, 0, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.code, CONF_ERR_KEY);
+	assert_int_equal(err.line, 1);
+	assert_int_equal(err.problems, 2);
+	assert_int_equal(conf->count, 1);
+	assert_int_equal(conf_get_long(conf, key, -1), 3);
+	key[MAX_KEY_LEN - 2] = '\0';
+	assert_null(conf_get_pair(conf, key));
+	conf_free(conf);
+
+	remove(ERROR_CONF_PATH);
+}
+
+static void test_conf_load_json(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fputs("{\n"
+		  "  \"server\": {\"host\": \"db1\", \"ports\": [5432, 5433]},\n"
+		  "  \"ratio\": 0.25, \"big\": 3000000000, \"neg\": -7,\n"
+		  "  \"escaped\": \"tab\\t\\\"q\\\"\\u00e9\\ud83d\\ude00\",\n"
+		  "  \"flags\": [true, false, null, {}, []],\n"
+		  "  \"matrix\": [[1, 2], [3, {\"x\": \"y\"}]]\n"
+		  "}\n",
+		  fp);
+	fclose(fp);
+
+	/* Scalars are stored under their flattened paths */
+	conf_error err;
+	conf_data* conf = conf_load_ex(JSON_PATH, CONF_JSON, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.problems, 0);
+	assert_string_equal(conf_get_string(conf, "server.host", "failed"), "db1");
+	assert_int_equal(conf_get_long(conf, "server.ports[0]", -1), 5432);
+	assert_int_equal(conf_get_long(conf, "server.ports[1]", -1), 5433);
+	assert_float_equal(conf_get_double(conf, "ratio", -1), 0.25,
+					   FLOAT_PRECISION);
+	assert_int_equal(conf_get_long(conf, "big", -1), L_VALUE);
+	assert_int_equal(conf_get_long(conf, "neg", -1), -7);
+	assert_string_equal(conf_get_string(conf, "escaped", "failed"),
+						"tab\t\"q\"\xc3\xa9\xf0\x9f\x98\x80");
+	assert_string_equal(conf_get_string(conf, "flags[0]", "failed"), "true");
+	assert_string_equal(conf_get_string(conf, "flags[1]", "failed"), "false");
+	assert_null(conf_get_pair(conf, "flags[2]"));
+	assert_null(conf_get_pair(conf, "flags[3]"));
+	assert_int_equal(conf_get_long(conf, "matrix[1][0]", -1), 3);
+	assert_string_equal(conf_get_string(conf, "matrix[1][1].x", "failed"),
+						"y");
+	assert_int_equal(conf->count, 13);
+	conf_free(conf);
+
+	/* Syntax errors fail the load and report their position */
+	fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fputs("{\"a\": 1,\n \"b\" 2}\n", fp);
+	fclose(fp);
+	assert_null(conf_load_ex(JSON_PATH, CONF_JSON, &err));
+	assert_int_equal(err.code, CONF_ERR_SYNTAX);
+	assert_int_equal(err.line, 2);
+	assert_int_equal(err.column, 6);
+
+	/* Values under empty keys are skipped unless the load is strict */
+	fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fputs("{\"\": 1, \"a\": 2}", fp);
+	fclose(fp);
+	conf = conf_load_ex(JSON_PATH, CONF_JSON, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.code, CONF_ERR_KEY);
+	assert_int_equal(err.problems, 1);
+	assert_int_equal(conf_get_long(conf, "a", -1), 2);
+	conf_free(conf);
+	assert_null(conf_load_ex(JSON_PATH, CONF_JSON | CONF_STRICT, &err));
+
+	remove(JSON_PATH);
+}
+
+static void test_conf_load_ini(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(INI_PATH, "w");
+	assert_non_null(fp);
+	fputs("; global settings\n"
+		  "Name = legacy ; trailing comment\n"
+		  "[Server]\n"
+		  "Port = 8080\n"
+		  "path = a;b\n"
+		  "greeting = \"hello ; world\"\n"
+		  "  [ Database.Primary ]  \n"
+		  "HOST = db1\n"
+		  "[]\n"
+		  "after = 1\n"
+		  "[broken\n",
+		  fp);
+	fclose(fp);
+
+	/* Sections prefix keys, and keys are folded to lower case */
+	conf_error err;
+	conf_data* conf = conf_load_ex(INI_PATH, CONF_INI, &err);
+	assert_non_null(conf);
+	assert_string_equal(conf_get_string(conf, "name", "failed"), "legacy");
+	assert_int_equal(conf_get_long(conf, "server.port", -1), 8080);
+	assert_string_equal(conf_get_string(conf, "server.path", "failed"),
+						"a;b");
+	assert_string_equal(conf_get_string(conf, "server.greeting", "failed"),
+						"hello ; world");
+	assert_string_equal(
+		conf_get_string(conf, "database.primary.host", "failed"), "db1");
+	assert_int_equal(conf_get_long(conf, "after", -1), 1);
+	assert_null(conf_get_pair(conf, "Server.Port"));
+	assert_int_equal(conf->count, 6);
+
+	/* Unterminated section headers are malformed lines */
+	assert_int_equal(err.code, CONF_ERR_SYNTAX);
+	assert_int_equal(err.line, 11);
+	assert_int_equal(err.problems, 1);
+	conf_free(conf);
+
+	/* Without the flag, sections and ';' comments are not recognized */
+	conf = conf_load_ex(INI_PATH, 0, &err);
+	assert_non_null(conf);
+	assert_string_equal(conf_get_string(conf, "Name", "failed"),
+						"legacy ; trailing comment");
+	assert_null(conf_get_pair(conf, "server.port"));
+	conf_free(conf);
+
+	/* Overlong sections are skipped with their keys, so they never alias */
+	char section[MAX_KEY_LEN];
+	memset(section, 's', sizeof(section) - 1);
+	section[sizeof(section) - 1] = '\0';
+	fp							 = fopen(INI_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "[%s1]\nkey = 1\n[%s2]\nkey = 2\n[short]\nkey = 3\n",
+			section, section);
+	fclose(fp);
+	conf = conf_load_ex(INI_PATH, CONF_INI, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.code, CONF_ERR_KEY);
+	assert_int_equal(err.line, 1);
+	assert_int_equal(err.problems, 2);
+	assert_int_equal(conf->count, 1);
+	assert_int_equal(conf_get_long(conf, "short.key", -1), 3);
+	conf_free(conf);
+
+	remove(INI_PATH);
+}
+
+static void test_conf_load_env(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(ENV_PATH, "w");
+	assert_non_null(fp);
+	fputs("# dotenv\n"
+		  "; EnvironmentFile comment\n"
+		  "export DB_HOST=db1\n"
+		  "  export   DB_PORT = 5432 # comment\n"
+		  "LITERAL='no \\n escapes # here'\n"
+		  "ESCAPED=\"tab\\tquote\\\"\"\n"
+		  "MULTI=\"first\n"
+		  "second\"\n"
+		  "BACKSLASH='ends in \\\n"
+		  "  kept'\n"
+		  "EMPTY=\n"
+		  "export PATH\n"
+		  "AFTER=value;kept\n",
+		  fp);
+	fclose(fp);
+
+	conf_error err;
+	conf_data* conf = conf_load_ex(ENV_PATH, CONF_ENV, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.problems, 0);
+	assert_string_equal(conf_get_string(conf, "DB_HOST", "failed"), "db1");
+	assert_int_equal(conf_get_long(conf, "DB_PORT", -1), 5432);
+	assert_string_equal(conf_get_string(conf, "LITERAL", "failed"),
+						"no \\n escapes # here");
+	assert_string_equal(conf_get_string(conf, "ESCAPED", "failed"),
+						"tab\tquote\"");
+	assert_string_equal(conf_get_string(conf, "MULTI", "failed"),
+						"first\nsecond");
+	assert_string_equal(conf_get_string(conf, "BACKSLASH", "failed"),
+						"ends in \\\n  kept");
+	assert_string_equal(conf_get_string(conf, "EMPTY", "failed"), "");
+	assert_string_equal(conf_get_string(conf, "AFTER", "failed"),
+						"value;kept");
+	assert_null(conf_get_pair(conf, "PATH"));
+	assert_int_equal(conf->count, 8);
+	conf_free(conf);
+
+	/* Unterminated quotes end at their own line, which reports them */
+	fp = fopen(ENV_PATH, "w");
+	assert_non_null(fp);
+	fputs("A=1\nB='open\nC=3\nD=\"open\nE=5\n", fp);
+	fclose(fp);
+	conf = conf_load_ex(ENV_PATH, CONF_ENV, &err);
+	assert_non_null(conf);
+	assert_int_equal(err.code, CONF_ERR_QUOTE);
+	assert_int_equal(err.line, 2);
+	assert_int_equal(err.problems, 2);
+	assert_int_equal(conf_get_long(conf, "A", -1), 1);
+	assert_int_equal(conf_get_long(conf, "C", -1), 3);
+	assert_int_equal(conf_get_long(conf, "E", -1), 5);
+	assert_int_equal(conf->count, 3);
+	conf_free(conf);
+
+	remove(ENV_PATH);
+}
+
+/**
+ * @brief Output collected by collect_chunk().
+ */
+typedef struct {
+	char*  buf;	   /**< Collected output */
+	size_t len;	   /**< Bytes of output */
+	size_t max;	   /**< Largest chunk */
+	int	   chunks; /**< Number of chunks */
+	int	   limit;  /**< Chunks to accept before stopping, 0 for all */
+} collected;
+
+/**
+ * @brief Write callback appending the chunks of conf_write_json().
+ */
+static int collect_chunk(const char* chunk, size_t len, void* ctx)
+{
+	collected* out = (collected*)ctx;
+	if (out->limit && out->chunks == out->limit) return -1;
+	out->buf = (char*)realloc(out->buf, out->len + len + 1);
+	assert_non_null(out->buf);
+	memcpy(out->buf + out->len, chunk, len);
+	out->len			 += len;
+	out->buf[out->len]	  = '\0';
+	out->max			  = len > out->max ? len : out->max;
+	out->chunks++;
+	return 0;
+}
+
+static void test_conf_write_json(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fputs("{\"a\": {\"b\": \"x\\\"y\\n\\u0001\"}, \"n\": -3, \"d\": 0.1}", fp);
+	fclose(fp);
+	conf_data* conf = conf_load_ex(JSON_PATH, CONF_JSON, NULL);
+	assert_non_null(conf);
+
+	/* Pairs are written with escapes, and overrides are included */
+	conf_value value;
+	value.cval		   = 'c';
+	conf_data* changed = conf_set(conf, "ch", CONF_CHAR, value);
+	assert_non_null(changed);
+	collected out = {NULL, 0, 0, 0, 0};
+	assert_int_equal(conf_write_json(changed, collect_chunk, &out), 0);
+	assert_string_equal(out.buf, "{\"a.b\":\"x\\\"y\\n\\u0001\",\"n\":-3,"
+								 "\"d\":0.1,\"ch\":\"c\"}");
+	free(out.buf);
+	conf_free(changed);
+	conf_free(conf);
+	remove(JSON_PATH);
+
+	/* Large outputs are passed on in bounded chunks and read back as JSON */
+	fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	for (int i = 0; i < MANY_KEYS; i++) {
+		fprintf(fp, "key_%d = %s %d\n", i, S_VALUE_LONG, i);
+	}
+	fclose(fp);
+	conf = conf_load(JSON_PATH);
+	assert_non_null(conf);
+	memset(&out, 0, sizeof(out));
+	assert_int_equal(conf_write_json(conf, collect_chunk, &out), 0);
+	assert_true(out.chunks > 1);
+	assert_true(out.max <= 4096);
+	fp = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fwrite(out.buf, 1, out.len, fp);
+	fclose(fp);
+	conf_data* copy = conf_load_ex(JSON_PATH, CONF_JSON, NULL);
+	assert_non_null(copy);
+	assert_int_equal(copy->count, conf->count);
+	free(out.buf);
+	conf_free(copy);
+	remove(JSON_PATH);
+
+	/* A callback can stop the output */
+	memset(&out, 0, sizeof(out));
+	out.limit = 1;
+	assert_int_equal(conf_write_json(conf, collect_chunk, &out), -1);
+	assert_int_equal(out.chunks, 1);
+	free(out.buf);
+	conf_free(conf);
+}
+
 static void test_conf_parse_key_not_found(void** state)
 {
 	(void)state; /* unused */
@@ -156,6 +593,112 @@ static void test_conf_parse_string(void** state)
 	conf_free(conf);
 }
 
+static void test_conf_parse_short_and_long_strings(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	const char* str_val = conf_get_string(conf, S_KEY_SHORT, "failed");
+	assert_string_equal(str_val, S_VALUE_SHORT);
+
+	str_val = conf_get_string(conf, S_KEY_LONG, "failed");
+	assert_string_equal(str_val, S_VALUE_LONG);
+
+	const conf_pair* pair = conf_get_pair(conf, S_KEY_SHORT);
+	assert_non_null(pair);
+	assert_int_equal(pair->type, CONF_STRING);
+	assert_string_equal(pair->value.str, S_VALUE_SHORT);
+
+	conf_free(conf);
+}
+
+static void test_conf_parse_quoted_string(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	/* Quotes keep whitespace, '#' and '=' */
+	const char* str_val = conf_get_string(conf, Q_KEY, "failed");
+	assert_string_equal(str_val, Q_VALUE);
+
+	/* Quoted numbers are strings */
+	str_val = conf_get_string(conf, Q_KEY_NUMBER, "failed");
+	assert_string_equal(str_val, "42");
+	assert_int_equal(conf_get_int(conf, Q_KEY_NUMBER, -1), -1);
+
+	str_val = conf_get_string(conf, Q_KEY_ESCAPED, "failed");
+	assert_string_equal(str_val, Q_VALUE_ESCAPED);
+
+	/* Unterminated quotes are skipped */
+	assert_null(conf_get_pair(conf, Q_KEY_UNTERMINATED));
+
+	conf_free(conf);
+}
+
+static void test_conf_parse_inline_comment(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	const char* str_val = conf_get_string(conf, C_KEY_STRING, "failed");
+	assert_string_equal(str_val, S_VALUE);
+
+	int int_val = conf_get_int(conf, C_KEY_INT, -1);
+	assert_int_equal(int_val, I_VALUE);
+
+	/* Comments only start outside of quotes and after whitespace */
+	str_val = conf_get_string(conf, C_KEY_QUOTED, "failed");
+	assert_string_equal(str_val, Q_VALUE);
+
+	str_val = conf_get_string(conf, C_KEY_HASH, "failed");
+	assert_string_equal(str_val, "a#b");
+
+	/* An indented comment does not override the first pair */
+	str_val = conf_get_string(conf, S_KEY, "failed");
+	assert_string_equal(str_val, S_VALUE);
+
+	conf_free(conf);
+}
+
+static void test_conf_parse_continuation_line(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	const char* str_val = conf_get_string(conf, C_KEY_CONTINUED, "failed");
+	assert_string_equal(str_val, S_VALUE);
+
+	conf_free(conf);
+}
+
+static void test_conf_parse_heredoc(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	/* Heredoc values are kept verbatim */
+	const char* str_val = conf_get_string(conf, H_KEY, "failed");
+	assert_string_equal(str_val, H_VALUE);
+
+	str_val = conf_get_string(conf, H_KEY_EMPTY, "failed");
+	assert_string_equal(str_val, "");
+
+	int int_val = conf_get_int(conf, H_KEY_AFTER, -1);
+	assert_int_equal(int_val, I_VALUE);
+
+	conf_free(conf);
+}
+
 static void test_conf_parse_integer(void** state)
 {
 	(void)state; /* unused */
@@ -208,6 +751,867 @@ static void test_conf_parse_double(void** state)
 	conf_free(conf);
 }
 
+static void test_conf_get_pair(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	const conf_pair* pair = conf_get_pair(conf, S_KEY);
+	assert_non_null(pair);
+	assert_string_equal(pair->key, S_KEY);
+	assert_int_equal(pair->type, CONF_STRING);
+	assert_string_equal(pair->value.str, S_VALUE);
+
+	pair = conf_get_pair(conf, L_KEY);
+	assert_non_null(pair);
+	assert_int_equal(pair->type, CONF_LONG);
+	assert_int_equal(pair->value.lval, L_VALUE);
+
+	assert_null(conf_get_pair(conf, "invalid_key"));
+
+	conf_free(conf);
+}
+
+static void test_conf_many_keys(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(MANY_CONF_PATH, "w");
+	assert_non_null(fp);
+	for (int i = 0; i < MANY_KEYS; i++) {
+		fprintf(fp, "key_%d=%d\n", i, i);
+	}
+	fprintf(fp, "key_0=duplicate\n");
+	fclose(fp);
+
+	conf_data* conf = conf_load(MANY_CONF_PATH);
+	assert_non_null(conf);
+	assert_int_equal(conf->count, MANY_KEYS + 1);
+
+	char key[32];
+	for (int i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "key_%d", i);
+		assert_int_equal(conf_get_int(conf, key, -1), i);
+	}
+
+	/* The first occurrence of a duplicated key wins */
+	assert_int_equal(conf_get_int(conf, "key_0", -1), 0);
+
+	/* Absent keys return the default value */
+	for (int i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "absent_%d", i);
+		assert_int_equal(conf_get_int(conf, key, -1), -1);
+	}
+
+	conf_free(conf);
+	remove(MANY_CONF_PATH);
+}
+
+static void test_conf_stats_shared_strings(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(SHARED_CONF_PATH, "w");
+	assert_non_null(fp);
+	for (int i = 0; i < MANY_KEYS; i++) {
+		fprintf(fp, "host_%d=%s\n", i, S_VALUE);
+		fprintf(fp, "lang_%d=%s\n", i, S_VALUE_SHORT);
+	}
+	fclose(fp);
+
+	conf_data* conf = conf_load(SHARED_CONF_PATH);
+	assert_non_null(conf);
+
+	/* Repeated values share a single stored copy */
+	const char* first = conf_get_string(conf, "host_0", NULL);
+	const char* last  = conf_get_string(conf, "host_999", NULL);
+	assert_string_equal(first, S_VALUE);
+	assert_ptr_equal(first, last);
+
+	conf_stats stats;
+	conf_get_stats(conf, &stats);
+	assert_int_equal(stats.pairs, 2 * MANY_KEYS);
+	assert_int_equal(stats.strings, 2 * MANY_KEYS);
+	assert_int_equal(stats.inline_strings, MANY_KEYS);
+	assert_int_equal(stats.shared_strings, MANY_KEYS - 1);
+	assert_int_equal(stats.saved_bytes, (MANY_KEYS - 1) * sizeof(S_VALUE));
+	assert_int_equal(stats.pool_bytes, sizeof(S_VALUE));
+
+	conf_free(conf);
+	remove(SHARED_CONF_PATH);
+}
+
+static void test_conf_load_batch(void** state)
+{
+	(void)state; /* unused */
+
+	/* More files than can be in flight at once, and one missing file */
+	static char names[BATCH_FILES + 1][32];
+	const char* filenames[BATCH_FILES + 1];
+	for (int i = 0; i < BATCH_FILES; i++) {
+		snprintf(names[i], sizeof(names[i]), BATCH_CONF_PATH, i);
+		FILE* fp = fopen(names[i], "w");
+		assert_non_null(fp);
+		fprintf(fp, "%s=%d\n%s=%s\n", I_KEY, i, S_KEY, S_VALUE_LONG);
+		fclose(fp);
+		filenames[i] = names[i];
+	}
+	filenames[BATCH_FILES] = "invalid.conf";
+
+	conf_data* results[BATCH_FILES + 1];
+	conf_error errors[BATCH_FILES + 1];
+	int		   loaded =
+		conf_load_batch(filenames, BATCH_FILES + 1, 0, results, errors);
+	assert_int_equal(loaded, BATCH_FILES);
+
+	for (int i = 0; i < BATCH_FILES; i++) {
+		assert_non_null(results[i]);
+		assert_int_equal(errors[i].code, CONF_OK);
+		assert_int_equal(conf_get_int(results[i], I_KEY, -1), i);
+		assert_string_equal(conf_get_string(results[i], S_KEY, "failed"),
+							S_VALUE_LONG);
+		conf_free(results[i]);
+	}
+	assert_null(results[BATCH_FILES]);
+	assert_int_equal(errors[BATCH_FILES].code, CONF_ERR_IO);
+
+	/* Parse errors are reported per file */
+	write_error_conf();
+	filenames[BATCH_FILES] = ERROR_CONF_PATH;
+	assert_int_equal(conf_load_batch(filenames + BATCH_FILES - 1, 2,
+									 CONF_STRICT, results, NULL),
+					 1);
+	assert_non_null(results[0]);
+	assert_int_equal(conf_get_int(results[0], I_KEY, -1), BATCH_FILES - 1);
+	assert_null(results[1]);
+	conf_free(results[0]);
+	remove(ERROR_CONF_PATH);
+
+	for (int i = 0; i < BATCH_FILES; i++) {
+		remove(names[i]);
+	}
+}
+
+/**
+ * @brief Records the result of a non-blocking load: 1 if the file was loaded,
+ * otherwise the negated error code.
+ */
+static void on_loaded(conf_data* data, const conf_error* err, void* ctx)
+{
+	int* result = (int*)ctx;
+	*result		= data ? 1 : -(int)err->code;
+	if (data) {
+		assert_int_equal(conf_get_int(data, I_KEY, -1), I_VALUE);
+		conf_free(data);
+	}
+}
+
+static void test_conf_load_async(void** state)
+{
+	(void)state; /* unused */
+
+	int loaded = 0;
+	int failed = 0;
+	int fd	   = conf_async_fd();
+	assert_true(fd >= 0);
+	assert_int_equal(conf_load_async(CONF_PATH, 0, on_loaded, &loaded), 0);
+	assert_int_equal(conf_load_async("invalid.conf", 0, on_loaded, &failed), 0);
+
+	/* Wait for the descriptor like an event loop would */
+	int dispatched = 0;
+	while (dispatched < 2) {
+		struct pollfd pfd = {fd, POLLIN, 0};
+		assert_int_equal(poll(&pfd, 1, 5000), 1);
+		dispatched += conf_async_dispatch();
+	}
+	assert_int_equal(loaded, 1);
+	assert_int_equal(failed, -CONF_ERR_IO);
+
+	/* Nothing is left to dispatch, and the descriptor is drained */
+	struct pollfd pfd = {fd, POLLIN, 0};
+	assert_int_equal(conf_async_dispatch(), 0);
+	assert_int_equal(poll(&pfd, 1, 0), 0);
+}
+
+static void test_conf_handle(void** state)
+{
+	(void)state; /* unused */
+
+	conf_handle* handle = conf_handle_create(CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+	assert_int_equal(conf_handle_generation(handle), 1);
+
+	int fd = conf_handle_notify_fd(handle);
+	assert_true(fd >= 0);
+	struct pollfd pfd = {fd, POLLIN, 0};
+	assert_int_equal(poll(&pfd, 1, 0), 0);
+
+	/* A reload publishes a new snapshot and signals the descriptor */
+	conf_data* old = conf_handle_acquire(handle);
+	assert_int_equal(conf_handle_reload(handle, NULL), 0);
+	assert_int_equal(conf_handle_generation(handle), 2);
+	assert_int_equal(poll(&pfd, 1, 0), 1);
+
+	uint64_t published = 0;
+	assert_int_equal(read(fd, &published, sizeof(published)),
+					 sizeof(published));
+	assert_int_equal(published, 1);
+	assert_int_equal(poll(&pfd, 1, 0), 0);
+
+	/* The old snapshot stays valid until it is freed */
+	conf_data* cur = conf_handle_acquire(handle);
+	assert_ptr_not_equal(old, cur);
+	assert_int_equal(conf_get_int(old, I_KEY, -1), I_VALUE);
+	assert_string_equal(conf_get_string(cur, S_KEY, "failed"), S_VALUE);
+	conf_free(old);
+	conf_free(cur);
+
+	conf_handle_free(handle);
+	assert_null(conf_handle_create("invalid.conf", 0, NULL));
+
+	/* A failed reload keeps the current snapshot */
+	write_error_conf();
+	handle = conf_handle_create(ERROR_CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+	remove(ERROR_CONF_PATH);
+	assert_int_equal(conf_handle_reload(handle, NULL), -1);
+	assert_int_equal(conf_handle_generation(handle), 1);
+	cur = conf_handle_acquire(handle);
+	assert_int_equal(conf_get_int(cur, I_KEY, -1), I_VALUE);
+	conf_free(cur);
+	conf_handle_free(handle);
+}
+
+/**
+ * @brief Reloads a handle after a short delay.
+ */
+static void* reload_later(void* arg)
+{
+	usleep(20000);
+	conf_handle_reload((conf_handle*)arg, NULL);
+	return NULL;
+}
+
+static void test_conf_txn(void** state)
+{
+	(void)state; /* unused */
+
+	conf_handle* handle = conf_handle_create(CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+	int fd = conf_handle_notify_fd(handle);
+	assert_true(fd >= 0);
+
+	/* Staged changes are invisible until the commit */
+	conf_value value;
+	conf_txn*  txn = conf_txn_begin(handle);
+	assert_non_null(txn);
+	value.lval = I_VALUE + 1;
+	assert_int_equal(conf_txn_set(txn, I_KEY, CONF_LONG, value), 0);
+	value.str = "staged";
+	assert_int_equal(conf_txn_set(txn, "new_key", CONF_STRING, value), 0);
+	assert_int_equal(conf_txn_remove(txn, S_KEY), 0);
+	value.lval = I_VALUE + 2;
+	assert_int_equal(conf_txn_set(txn, I_KEY, CONF_LONG, value), 0);
+	assert_int_equal(conf_txn_set(txn, "", CONF_LONG, value), -1);
+	assert_int_equal(conf_handle_generation(handle), 1);
+
+	/* The commit publishes one snapshot and signals once */
+	assert_int_equal(conf_txn_commit(txn), 2);
+	uint64_t published = 0;
+	assert_int_equal(read(fd, &published, sizeof(published)),
+					 sizeof(published));
+	assert_int_equal(published, 1);
+
+	conf_data* cur = conf_handle_acquire(handle);
+	assert_int_equal(conf_get_int(cur, I_KEY, -1), I_VALUE + 2);
+	assert_string_equal(conf_get_string(cur, "new_key", "failed"), "staged");
+	assert_null(conf_get_pair(cur, S_KEY));
+	conf_free(cur);
+
+	/* Aborted and empty transactions publish nothing */
+	txn = conf_txn_begin(handle);
+	assert_int_equal(conf_txn_remove(txn, I_KEY), 0);
+	conf_txn_abort(txn);
+	assert_int_equal(conf_txn_commit(conf_txn_begin(handle)), 2);
+	assert_int_equal(conf_handle_generation(handle), 2);
+
+	conf_handle_free(handle);
+}
+
+static void test_conf_rollback(void** state)
+{
+	(void)state; /* unused */
+
+	conf_handle* handle = conf_handle_create(CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+
+	/* Without history, there is nothing to roll back to */
+	assert_int_equal(conf_rollback(handle, 1), 0);
+	assert_int_equal(conf_handle_set_history(handle, 3), 0);
+
+	/* Publish generations 2 to 5 with distinct values */
+	for (int i = 1; i <= 4; i++) {
+		conf_value value;
+		value.lval = I_VALUE + i;
+
+		conf_data* cur	= conf_handle_acquire(handle);
+		conf_data* next = conf_set(cur, I_KEY, CONF_LONG, value);
+		assert_non_null(next);
+		conf_handle_publish(handle, next);
+		conf_free(cur);
+	}
+	assert_int_equal(conf_rollback(handle, 4), 0);
+
+	/* Rolling back republishes an older snapshot as a new generation */
+	assert_int_equal(conf_rollback(handle, 2), 6);
+	conf_data* cur = conf_handle_acquire(handle);
+	assert_int_equal(conf_get_int(cur, I_KEY, -1), I_VALUE + 2);
+	conf_free(cur);
+
+	/* Rolling back by one undoes the rollback */
+	assert_int_equal(conf_rollback(handle, 1), 7);
+	cur = conf_handle_acquire(handle);
+	assert_int_equal(conf_get_int(cur, I_KEY, -1), I_VALUE + 4);
+	conf_free(cur);
+
+	/* Shrinking the history keeps the newest snapshot */
+	assert_int_equal(conf_handle_set_history(handle, 1), 0);
+	assert_int_equal(conf_rollback(handle, 2), 0);
+	assert_int_equal(conf_rollback(handle, 1), 8);
+	cur = conf_handle_acquire(handle);
+	assert_int_equal(conf_get_int(cur, I_KEY, -1), I_VALUE + 2);
+	conf_free(cur);
+
+	conf_handle_free(handle);
+}
+
+/**
+ * @brief Checks the values of the journaled file of test_conf_journal().
+ */
+static void check_journal_conf(const conf_data* conf)
+{
+	assert_non_null(conf);
+	assert_int_equal(conf_get_long(conf, I_KEY, -1), I_VALUE + 1);
+	assert_string_equal(conf_get_string(conf, Q_KEY, "failed"),
+						Q_VALUE_ESCAPED);
+	assert_null(conf_get_pair(conf, S_KEY));
+	assert_float_equal(conf_get_double(conf, D_KEY, -1), D_VALUE,
+					   FLOAT_PRECISION);
+}
+
+static void test_conf_journal(void** state)
+{
+	(void)state; /* unused */
+
+	FILE* fp = fopen(JOURNAL_CONF_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "%s=%d\n%s=%s\n", I_KEY, I_VALUE, S_KEY, S_VALUE);
+	fclose(fp);
+	unlink(JOURNAL_PATH);
+
+	/* Journaled changes are replayed on top of the file when it is loaded */
+	conf_journal* journal = conf_journal_open(JOURNAL_CONF_PATH, 0, 0);
+	assert_non_null(journal);
+	conf_value value;
+	value.ival = I_VALUE + 1;
+	assert_int_equal(conf_journal_set(journal, I_KEY, CONF_INT, value), 0);
+	value.str = Q_VALUE_ESCAPED;
+	assert_int_equal(conf_journal_set(journal, Q_KEY, CONF_STRING, value), 0);
+	assert_int_equal(conf_journal_remove(journal, S_KEY), 0);
+	value.str = "a=b";
+	assert_int_equal(conf_journal_set(journal, value.str, CONF_STRING, value),
+					 -1);
+	assert_int_equal(errno, EINVAL);
+	conf_journal_close(journal);
+
+	/* A partial record left by a crash is ignored, and cut off on reopening */
+	fp = fopen(JOURNAL_PATH, "a");
+	assert_non_null(fp);
+	fputs("partial", fp);
+	fclose(fp);
+	conf_data* conf = conf_load(JOURNAL_CONF_PATH);
+	assert_non_null(conf);
+	assert_int_equal(conf_get_long(conf, I_KEY, -1), I_VALUE + 1);
+	assert_null(conf_get_pair(conf, S_KEY));
+	conf_free(conf);
+
+	journal = conf_journal_open(JOURNAL_CONF_PATH, 0, 0);
+	assert_non_null(journal);
+	value.dval = D_VALUE;
+	assert_int_equal(conf_journal_set(journal, D_KEY, CONF_DOUBLE, value), 0);
+	conf = conf_load(JOURNAL_CONF_PATH);
+	check_journal_conf(conf);
+	conf_free(conf);
+
+	/* Compaction keeps the last record of each key and leaves the file alone */
+	struct stat st;
+	struct stat base;
+	value.ival = I_VALUE + 1;
+	assert_int_equal(conf_journal_set(journal, I_KEY, CONF_INT, value), 0);
+	value.dval = 2.0;
+	assert_int_equal(conf_journal_set(journal, "whole", CONF_DOUBLE, value), 0);
+	assert_int_equal(stat(JOURNAL_CONF_PATH, &base), 0);
+	assert_int_equal(stat(JOURNAL_PATH, &st), 0);
+	off_t size = st.st_size;
+	assert_int_equal(conf_journal_compact(journal), 0);
+	assert_int_equal(stat(JOURNAL_PATH, &st), 0);
+	assert_true(st.st_size < size);
+	size = st.st_size;
+	assert_int_equal(stat(JOURNAL_CONF_PATH, &st), 0);
+	assert_int_equal(st.st_ino, base.st_ino);
+	assert_int_equal(st.st_size, base.st_size);
+	conf = conf_load(JOURNAL_CONF_PATH);
+	check_journal_conf(conf);
+	const conf_pair* pair = conf_get_pair(conf, "whole");
+	assert_non_null(pair);
+	assert_int_equal(pair->type, CONF_DOUBLE);
+	conf_free(conf);
+	conf_journal_close(journal);
+
+	/* Journals beyond their size limit are compacted on append */
+	journal = conf_journal_open(JOURNAL_CONF_PATH, 0, 16);
+	assert_non_null(journal);
+	value.ival = I_VALUE + 1;
+	assert_int_equal(conf_journal_set(journal, I_KEY, CONF_INT, value), 0);
+	assert_int_equal(stat(JOURNAL_PATH, &st), 0);
+	assert_int_equal(st.st_size, size);
+	conf = conf_load(JOURNAL_CONF_PATH);
+	check_journal_conf(conf);
+	conf_free(conf);
+	conf_journal_close(journal);
+
+	unlink(JOURNAL_PATH);
+	unlink(JOURNAL_CONF_PATH);
+}
+
+static void test_conf_journal_json(void** state)
+{
+	(void)state; /* unused */
+
+	const char* text = "{\"server\": {\"host\": \"db1\"}, \"ratio\": 0.25}\n";
+	FILE*		fp	 = fopen(JSON_PATH, "w");
+	assert_non_null(fp);
+	fputs(text, fp);
+	fclose(fp);
+	unlink(JSON_PATH ".journal");
+
+	/* JSON journals accept any key a JSON object could hold */
+	conf_journal* journal = conf_journal_open(JSON_PATH, CONF_JSON, 0);
+	assert_non_null(journal);
+	conf_value value;
+	value.str = "db2";
+	assert_int_equal(conf_journal_set(journal, "server.host", CONF_STRING,
+									  value),
+					 0);
+	value.str = "x";
+	assert_int_equal(conf_journal_set(journal, "a=b", CONF_STRING, value), 0);
+	value.dval = 2.0;
+	assert_int_equal(conf_journal_set(journal, "ratio", CONF_DOUBLE, value),
+					 0);
+
+	/* Compaction leaves the JSON file as it is */
+	char buf[128];
+	assert_int_equal(conf_journal_compact(journal), 0);
+	conf_journal_close(journal);
+	fp = fopen(JSON_PATH, "r");
+	assert_non_null(fp);
+	size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[len] = '\0';
+	assert_string_equal(buf, text);
+
+	conf_data* conf = conf_load_ex(JSON_PATH, CONF_JSON, NULL);
+	assert_non_null(conf);
+	assert_string_equal(conf_get_string(conf, "server.host", "failed"), "db2");
+	assert_string_equal(conf_get_string(conf, "a=b", "failed"), "x");
+	const conf_pair* pair = conf_get_pair(conf, "ratio");
+	assert_non_null(pair);
+	assert_int_equal(pair->type, CONF_DOUBLE);
+	assert_float_equal(pair->value.dval, 2.0, FLOAT_PRECISION);
+	conf_free(conf);
+
+	unlink(JSON_PATH ".journal");
+	remove(JSON_PATH);
+}
+
+static void test_conf_wait_for_change(void** state)
+{
+	(void)state; /* unused */
+
+	conf_handle* handle = conf_handle_create(CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+
+	/* Nothing is published, so the wait times out */
+	unsigned long generation = conf_handle_generation(handle);
+	assert_int_equal(conf_wait_for_change(handle, generation, 10), 0);
+
+	/* A publish from another thread ends the wait */
+	pthread_t thread;
+	assert_int_equal(pthread_create(&thread, NULL, reload_later, handle), 0);
+	assert_int_equal(conf_wait_for_change(handle, generation, -1), 1);
+	assert_int_equal(conf_handle_generation(handle), generation + 1);
+	pthread_join(thread, NULL);
+
+	/* An older generation returns at once */
+	assert_int_equal(conf_wait_for_change(handle, generation, 0), 1);
+	conf_handle_free(handle);
+}
+
+static void test_conf_handle_watch_sighup(void** state)
+{
+	(void)state; /* unused */
+
+	conf_handle* handle = conf_handle_create(CONF_PATH, 0, NULL);
+	assert_non_null(handle);
+	assert_int_equal(conf_handle_watch_sighup(handle), 0);
+
+	/* Repeated signals cause at least one reload */
+	unsigned long generation = conf_handle_generation(handle);
+	assert_int_equal(kill(getpid(), SIGHUP), 0);
+	assert_int_equal(kill(getpid(), SIGHUP), 0);
+	assert_int_equal(conf_wait_for_change(handle, generation, 5000), 1);
+	assert_true(conf_handle_generation(handle) <= generation + 2);
+
+	conf_handle_unwatch_sighup(handle);
+	conf_handle_free(handle);
+}
+
+static void test_conf_set(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	/* Setting a value creates a new version, the old one is unchanged */
+	conf_value value;
+	value.ival		 = I_VALUE + 1;
+	conf_data* first = conf_set(conf, I_KEY, CONF_INT, value);
+	assert_non_null(first);
+	assert_int_equal(conf_get_int(first, I_KEY, -1), I_VALUE + 1);
+	assert_int_equal(conf_get_long(first, I_KEY, -1), I_VALUE + 1);
+	assert_int_equal(conf_get_int(conf, I_KEY, -1), I_VALUE);
+	assert_int_equal(first->count, conf->count);
+
+	/* New keys are added, and unchanged keys come from the loaded data */
+	value.str			= "runtime value";
+	conf_data* second	= conf_set(first, "new_key", CONF_STRING, value);
+	assert_non_null(second);
+	assert_string_equal(conf_get_string(second, "new_key", "failed"),
+						"runtime value");
+	assert_string_equal(conf_get_string(second, S_KEY, "failed"), S_VALUE);
+	assert_int_equal(conf_get_int(second, I_KEY, -1), I_VALUE + 1);
+	assert_null(conf_get_pair(first, "new_key"));
+	assert_int_equal(second->count, conf->count + 1);
+
+	const conf_pair* pair = conf_get_pair(second, "new_key");
+	assert_non_null(pair);
+	assert_int_equal(pair->type, CONF_STRING);
+	assert_string_equal(pair->value.str, "runtime value");
+	assert_string_equal(conf_get_pair(second, S_KEY)->value.str, S_VALUE);
+
+	/* Removed keys are hidden, also if they were loaded */
+	conf_data* third = conf_remove(second, S_KEY);
+	assert_non_null(third);
+	assert_null(conf_get_pair(third, S_KEY));
+	assert_string_equal(conf_get_string(third, S_KEY, "default"), "default");
+	assert_int_equal(third->count, conf->count);
+	conf_data* fourth = conf_remove(third, "new_key");
+	assert_non_null(fourth);
+	assert_null(conf_get_string(fourth, "new_key", NULL));
+	assert_int_equal(fourth->count, conf->count - 1);
+	assert_string_equal(conf_get_string(second, S_KEY, "failed"), S_VALUE);
+
+	/* Removing an absent key returns the same version */
+	conf_data* same = conf_remove(fourth, "absent_key");
+	assert_ptr_equal(same, fourth);
+	conf_free(same);
+
+	/* Versions stay valid after the data they were derived from is freed */
+	conf_free(conf);
+	conf_free(first);
+	conf_free(second);
+	conf_free(third);
+	assert_int_equal(conf_get_int(fourth, I_KEY, -1), I_VALUE + 1);
+	conf_free(fourth);
+}
+
+static void test_conf_set_many_keys(void** state)
+{
+	(void)state; /* unused */
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+
+	/* Enough keys to split leaves into several levels of the trie */
+	char	   key[MAX_KEY_LEN];
+	conf_value value;
+	for (int i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "override_%d", i);
+		value.lval		  = i;
+		conf_data* update = conf_set(conf, key, CONF_LONG, value);
+		assert_non_null(update);
+		conf_free(conf);
+		conf = update;
+	}
+	for (int i = 0; i < MANY_KEYS; i += 2) {
+		snprintf(key, sizeof(key), "override_%d", i);
+		conf_data* update = conf_remove(conf, key);
+		assert_non_null(update);
+		conf_free(conf);
+		conf = update;
+	}
+
+	for (int i = 0; i < MANY_KEYS; i++) {
+		snprintf(key, sizeof(key), "override_%d", i);
+		assert_int_equal(conf_get_long(conf, key, -1), i % 2 ? i : -1);
+	}
+	assert_int_equal(conf_get_int(conf, I_KEY, -1), I_VALUE);
+	conf_free(conf);
+}
+
+/**
+ * @brief Writes a configuration file without malformed lines for the cache.
+ */
+static void write_cache_conf(int value)
+{
+	FILE* fp = fopen(CACHE_CONF_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "%s=%d\n", I_KEY, value);
+	fprintf(fp, "%s=%s\n", S_KEY_SHORT, S_VALUE_SHORT);
+	fprintf(fp, "%s=%s\n", S_KEY_LONG, S_VALUE_LONG);
+	fprintf(fp, "%s=%s\n", S_KEY, S_VALUE_LONG);
+	fprintf(fp, "%s=\"%s\"\n", Q_KEY, Q_VALUE);
+	fprintf(fp, "%s=%f\n", D_KEY, D_VALUE);
+	fclose(fp);
+}
+
+/**
+ * @brief Checks the values written by write_cache_conf().
+ */
+static void check_cache_conf(const conf_data* conf, int value)
+{
+	assert_non_null(conf);
+	assert_int_equal(conf->count, 6);
+	assert_int_equal(conf_get_int(conf, I_KEY, -1), value);
+	assert_string_equal(conf_get_string(conf, S_KEY_SHORT, "failed"),
+						S_VALUE_SHORT);
+	assert_string_equal(conf_get_string(conf, S_KEY_LONG, "failed"),
+						S_VALUE_LONG);
+	assert_string_equal(conf_get_string(conf, S_KEY, "failed"), S_VALUE_LONG);
+	assert_string_equal(conf_get_string(conf, Q_KEY, "failed"), Q_VALUE);
+	assert_float_equal(conf_get_double(conf, D_KEY, -1), D_VALUE,
+					   FLOAT_PRECISION);
+	assert_null(conf_get_pair(conf, "invalid_key"));
+	assert_string_equal(conf_get_pair(conf, I_KEY)->key, I_KEY);
+}
+
+static void test_conf_parse_cache(void** state)
+{
+	(void)state; /* unused */
+
+	char dir[] = CACHE_DIR_TEMPLATE;
+	assert_non_null(mkdtemp(dir));
+	assert_int_equal(conf_set_cache_dir(dir), 0);
+	write_cache_conf(I_VALUE);
+
+	/* The first load parses the file and saves it to the cache */
+	conf_stats stats;
+	conf_data* conf = conf_load(CACHE_CONF_PATH);
+	check_cache_conf(conf, I_VALUE);
+	conf_get_stats(conf, &stats);
+	assert_true(stats.pool_bytes > 0);
+	conf_free(conf);
+
+	/* The second load maps the cache file, which has no string pool */
+	conf = conf_load(CACHE_CONF_PATH);
+	check_cache_conf(conf, I_VALUE);
+	conf_get_stats(conf, &stats);
+	assert_int_equal(stats.pool_bytes, 0);
+	conf_free(conf);
+
+	/* A change of the same size within the same timestamp is still seen */
+	write_cache_conf(I_VALUE + 1);
+	conf = conf_load(CACHE_CONF_PATH);
+	check_cache_conf(conf, I_VALUE + 1);
+	conf_free(conf);
+
+	assert_int_equal(conf_set_cache_dir(NULL), 0);
+	remove(CACHE_CONF_PATH);
+
+	DIR*		   d = opendir(dir);
+	struct dirent* entry;
+	char		   path[sizeof(dir) + 256];
+	assert_non_null(d);
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		remove(path);
+	}
+	closedir(d);
+	assert_int_equal(rmdir(dir), 0);
+}
+
+static void test_conf_snapshot(void** state)
+{
+	(void)state; /* unused */
+
+	write_cache_conf(I_VALUE);
+	conf_data* conf = conf_load(CACHE_CONF_PATH);
+	assert_non_null(conf);
+
+	/* The mapped snapshot holds the same pairs, without a string pool */
+	int fd = conf_snapshot_fd(conf);
+	assert_true(fd >= 0);
+	conf_data* snapshot = conf_snapshot_map(fd);
+	close(fd);
+	check_cache_conf(snapshot, I_VALUE);
+	conf_stats stats;
+	conf_get_stats(snapshot, &stats);
+	assert_int_equal(stats.pool_bytes, 0);
+	conf_free(snapshot);
+	conf_free(conf);
+
+	/* Journaled overrides are copied into the snapshot */
+	FILE* fp = fopen(JOURNAL_CONF_PATH, "w");
+	assert_non_null(fp);
+	fprintf(fp, "%s=%d\n%s=%s\n", I_KEY, I_VALUE, S_KEY, S_VALUE);
+	fclose(fp);
+	unlink(JOURNAL_PATH);
+	conf_journal* journal = conf_journal_open(JOURNAL_CONF_PATH, 0, 0);
+	assert_non_null(journal);
+	conf_value value;
+	value.ival = I_VALUE + 1;
+	assert_int_equal(conf_journal_set(journal, I_KEY, CONF_INT, value), 0);
+	value.dval = D_VALUE;
+	assert_int_equal(conf_journal_set(journal, D_KEY, CONF_DOUBLE, value), 0);
+	assert_int_equal(conf_journal_remove(journal, S_KEY), 0);
+	conf_journal_close(journal);
+	conf = conf_load(JOURNAL_CONF_PATH);
+	assert_non_null(conf);
+	assert_non_null(conf->overrides);
+	fd = conf_snapshot_fd(conf);
+	assert_true(fd >= 0);
+	snapshot = conf_snapshot_map(fd);
+	close(fd);
+	assert_non_null(snapshot);
+	assert_null(snapshot->overrides);
+	assert_int_equal(snapshot->count, 2);
+	assert_int_equal(conf_get_long(snapshot, I_KEY, -1), I_VALUE + 1);
+	assert_float_equal(conf_get_double(snapshot, D_KEY, -1), D_VALUE,
+					   FLOAT_PRECISION);
+	assert_null(conf_get_pair(snapshot, S_KEY));
+	conf_free(snapshot);
+	conf_free(conf);
+	unlink(JOURNAL_PATH);
+	unlink(JOURNAL_CONF_PATH);
+
+	/* Descriptors that are not sealed snapshots are rejected */
+	fd = open(CACHE_CONF_PATH, O_RDONLY);
+	assert_true(fd >= 0);
+	assert_null(conf_snapshot_map(fd));
+	close(fd);
+
+	remove(CACHE_CONF_PATH);
+}
+
+/**
+ * @brief Writes a schema file with the given rule lines.
+ */
+static void write_schema(const char* rules)
+{
+	FILE* fp = fopen(SCHEMA_PATH, "w");
+	assert_non_null(fp);
+	fputs(rules, fp);
+	fclose(fp);
+}
+
+static void test_conf_validate(void** state)
+{
+	(void)state; /* unused */
+
+	/* Numbers match allowed values of the same value in any spelling */
+	write_schema(S_KEY " = string required 1..64\n" I_KEY
+				   " = int required 1..100\n" L_KEY " = long enum 1|3e9\n" D_KEY
+				   " = double 0..10 enum 2.71828|1\n" S_KEY_SHORT
+				   " = string enum en|de|fr\n"
+				   "optional_key = int\n");
+
+	conf_error	 err;
+	conf_schema* schema = conf_schema_compile(SCHEMA_PATH, &err);
+	assert_non_null(schema);
+
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+	assert_int_equal(conf_validate(conf, schema, &err), 0);
+	assert_int_equal(err.code, CONF_OK);
+	assert_int_equal(err.problems, 0);
+
+	conf_free(conf);
+	conf_schema_free(schema);
+	remove(SCHEMA_PATH);
+}
+
+static void test_conf_validate_violations(void** state)
+{
+	(void)state; /* unused */
+
+	write_schema("missing_key = string required\n" S_KEY " = int\n" I_KEY
+				 " = int 0..10\n" S_KEY_SHORT " = string enum de|fr\n" L_KEY
+				 " = int\n" D_KEY " = double enum 2.7|3\n");
+
+	conf_error	 err;
+	conf_schema* schema = conf_schema_compile(SCHEMA_PATH, &err);
+	assert_non_null(schema);
+
+	/* The first violated rule is reported, all of them are counted */
+	conf_data* conf = conf_load(CONF_PATH);
+	assert_non_null(conf);
+	assert_int_equal(conf_validate(conf, schema, &err), -1);
+	assert_int_equal(err.code, CONF_ERR_MISSING);
+	assert_string_equal(err.key, "missing_key");
+	assert_int_equal(err.problems, 6);
+
+	conf_free(conf);
+	conf_schema_free(schema);
+	remove(SCHEMA_PATH);
+}
+
+static void test_conf_schema_compile_invalid(void** state)
+{
+	(void)state; /* unused */
+
+	conf_error err;
+	write_schema(I_KEY " = int\n" S_KEY " = text required\n");
+	assert_null(conf_schema_compile(SCHEMA_PATH, &err));
+	assert_int_equal(err.code, CONF_ERR_SCHEMA);
+	assert_string_equal(err.reason, "unknown type");
+	assert_string_equal(err.key, S_KEY);
+	assert_int_equal(err.line, 2);
+
+	write_schema(S_KEY " = string enum\n");
+	assert_null(conf_schema_compile(SCHEMA_PATH, &err));
+	assert_int_equal(err.code, CONF_ERR_SCHEMA);
+
+	/* Later rules of a key would never apply, so they are rejected */
+	write_schema(I_KEY " = int\n" S_KEY " = string \\\n  required\n" I_KEY
+					   " = long\n");
+	assert_null(conf_schema_compile(SCHEMA_PATH, &err));
+	assert_int_equal(err.code, CONF_ERR_SCHEMA);
+	assert_string_equal(err.reason, "duplicate rule");
+	assert_string_equal(err.key, I_KEY);
+	assert_int_equal(err.line, 4);
+
+	/* Schema files are loaded in strict mode */
+	write_schema(I_KEY " int\n");
+	assert_null(conf_schema_compile(SCHEMA_PATH, &err));
+	assert_int_equal(err.code, CONF_ERR_SYNTAX);
+
+	remove(SCHEMA_PATH);
+}
+
 int main(void)
 {
 	setup();
@@ -215,7 +1619,33 @@ int main(void)
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_conf_load),
 		cmocka_unit_test(test_conf_load_invalid),
+		cmocka_unit_test(test_conf_load_ex_invalid),
+		cmocka_unit_test(test_conf_load_ex_diagnostics),
+		cmocka_unit_test(test_conf_load_ex_strict),
+		cmocka_unit_test(test_conf_load_long_keys),
+		cmocka_unit_test(test_conf_load_json),
+		cmocka_unit_test(test_conf_load_ini),
+		cmocka_unit_test(test_conf_load_env),
+		cmocka_unit_test(test_conf_write_json),
+		cmocka_unit_test(test_conf_load_batch),
+		cmocka_unit_test(test_conf_load_async),
+		cmocka_unit_test(test_conf_set),
+		cmocka_unit_test(test_conf_set_many_keys),
+		cmocka_unit_test(test_conf_handle),
+		cmocka_unit_test(test_conf_txn),
+		cmocka_unit_test(test_conf_rollback),
+		cmocka_unit_test(test_conf_journal),
+		cmocka_unit_test(test_conf_journal_json),
+		cmocka_unit_test(test_conf_wait_for_change),
+		cmocka_unit_test(test_conf_handle_watch_sighup),
+		cmocka_unit_test(test_conf_parse_cache),
+		cmocka_unit_test(test_conf_snapshot),
 		cmocka_unit_test(test_conf_parse_string),
+		cmocka_unit_test(test_conf_parse_short_and_long_strings),
+		cmocka_unit_test(test_conf_parse_quoted_string),
+		cmocka_unit_test(test_conf_parse_inline_comment),
+		cmocka_unit_test(test_conf_parse_continuation_line),
+		cmocka_unit_test(test_conf_parse_heredoc),
 		cmocka_unit_test(test_conf_parse_integer),
 		cmocka_unit_test(test_conf_parse_long),
 		cmocka_unit_test(test_conf_parse_float),
@@ -224,6 +1654,12 @@ int main(void)
 		cmocka_unit_test(test_conf_remove_whitespaces_in_value),
 		cmocka_unit_test(test_conf_remove_whitespaces_in_key_before),
 		cmocka_unit_test(test_conf_remove_whitespaces_in_key_after),
+		cmocka_unit_test(test_conf_get_pair),
+		cmocka_unit_test(test_conf_many_keys),
+		cmocka_unit_test(test_conf_stats_shared_strings),
+		cmocka_unit_test(test_conf_validate),
+		cmocka_unit_test(test_conf_validate_violations),
+		cmocka_unit_test(test_conf_schema_compile_invalid),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);